@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "view.h"
+#include "file.h"
+#include "copy.h"
+#include "clock.h"
+
+/* Copy of a large file, on one thread then by ranges on several threads,
+ * with the page cache dropped before each copy when run as root. The copy
+ * uses copy_file_range within a filesystem, a destination directory on
+ * another filesystem or building with -DNO_COPY_FILE_RANGE measures the
+ * read and write loop. Each copy is compared to the source.
+ * usage: bench/chunks [megabytes] [directory] [destination directory] */
+
+#define MEGABYTES 1024
+#define DIRECTORY "/tmp"
+#define BLOCK (1024 * 1024)
+
+static const char *strategies[COPY_STRATEGIES] = {
+	"cloned", "copy_file_range", "read/write", "io_uring"
+};
+
+/* drop the page cache, returns -1 if not allowed */
+static int drop_caches(void) {
+	int fd, ret;
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0) return -1;
+	ret = write(fd, "3", 1) == 1 ? 0 : -1;
+	close(fd);
+	return ret;
+}
+
+/* write a file of random bytes, returns -1 on error */
+static int fill(const char *path, size_t megabytes) {
+	char *block;
+	size_t i, j;
+	int fd, ret;
+
+	block = malloc(BLOCK);
+	if (!block) return -1;
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0) {
+		free(block);
+		return -1;
+	}
+	ret = 0;
+	for (i = 0; !ret && i < megabytes; i++) {
+		for (j = 0; j < BLOCK; j++) block[j] = rand();
+		if (write(fd, block, BLOCK) != BLOCK) ret = -1;
+	}
+	if (close(fd)) ret = -1;
+	free(block);
+	return ret;
+}
+
+/* returns 0 if both files have the same content */
+static int compare(const char *a, const char *b) {
+	char *x, *y;
+	ssize_t i, j;
+	int fa, fb, ret;
+
+	x = malloc(BLOCK);
+	y = malloc(BLOCK);
+	fa = open(a, O_RDONLY);
+	fb = open(b, O_RDONLY);
+	ret = !x || !y || fa < 0 || fb < 0;
+	while (!ret) {
+		i = read(fa, x, BLOCK);
+		j = read(fb, y, BLOCK);
+		if (i != j || i < 0 || memcmp(x, y, i)) ret = -1;
+		if (i <= 0) break;
+	}
+	if (fa >= 0) close(fa);
+	if (fb >= 0) close(fb);
+	free(x);
+	free(y);
+	return ret;
+}
+
+/* copy src to dst with the given number of threads */
+static void run(const char *src, const char *dst, const char *threads) {
+
+	struct stat st;
+	double start, elapsed;
+	int in, out, strategy;
+
+	setenv("MZ_CHUNK_THREADS", threads, 1);
+	unlink(dst);
+	drop_caches();
+	in = open(src, O_RDONLY);
+	out = open(dst, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (in < 0 || out < 0 || fstat(in, &st)) exit(1);
+
+	start = clock_monotonic();
+	strategy = copy_file(in, out, &st, NULL, NULL);
+	if (fsync(out)) strategy = -1;
+	elapsed = clock_elapsed(start);
+	close(in);
+	close(out);
+
+	if (strategy < 0) {
+		printf("chunks: %s threads: error\n", threads);
+	} else {
+		printf("chunks: %s threads, %s: %.0f MB/s%s\n", threads,
+			strategies[strategy], st.st_size / elapsed / 1e6,
+			compare(src, dst) ? " (copy differs)" : "");
+	}
+	unlink(dst);
+}
+
+int main(int argc, char *argv[]) {
+
+	char src[1024], dst[1024];
+	size_t megabytes;
+
+	megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : MEGABYTES;
+	snprintf(src, sizeof(src), "%s/mz-bench-chunks",
+			argc > 2 ? argv[2] : DIRECTORY);
+	snprintf(dst, sizeof(dst), "%s/mz-bench-chunks.copy",
+			argc > 3 ? argv[3] : argc > 2 ? argv[2] : DIRECTORY);
+	if (fill(src, megabytes)) return 1;
+
+	run(src, dst, "1");
+	run(src, dst, "4");
+
+	unlink(src);
+	return 0;
+}
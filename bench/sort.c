@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include "termbox.h"
+#include "arena.h"
+#include "view.h"
+#include "file.h"
+#include "sort.h"
+#include "clock.h"
+
+/* Sort of a listing of random names, on their collation keys and with the
+ * comparator decoding the names used before them. The order of the keys is
+ * checked against the old comparator.
+ * usage: bench/sort [names] */
+
+#define NAMES 1000000
+
+static const char *names;
+
+/* comparator of the previous versions */
+static int compare(const void *a, const void *b) {
+	const char *first = &names[((const struct entry*)a)->name];
+	const char *second = &names[((const struct entry*)b)->name];
+	int type1 = ((const struct entry*)a)->type;
+	int type2 = ((const struct entry*)b)->type;
+	int i = 0, j = 0;
+
+	if (type1 != type2) {
+		if (type1 == DT_DIR) return -1;
+		if (type2 == DT_DIR) return 1;
+	}
+	while (1) {
+		uint32_t c1, c2;
+		do {
+			if (!first[i]) return 0;
+			i += tb_utf8_char_to_unicode(&c1, &first[i]);
+		} while (c1 == ' ' || c1 == '\t');
+		do {
+			if (!second[j]) return 0;
+			j += tb_utf8_char_to_unicode(&c2, &second[j]);
+		} while (c2 == ' ' || c2 == '\t');
+		c1 = tolower(c1);
+		c2 = tolower(c2);
+		if (c1 != c2)
+			return c1 < c2 ? -1 : 1;
+	}
+	return 0;
+}
+
+/* random name of letters, digits, spaces and a few accents */
+static size_t random_name(char *out) {
+	static const char *chars =
+		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ._-";
+	size_t i, length = 4 + rand() % 20;
+	for (i = 0; i < length; i++) {
+		if (rand() % 16) {
+			out[i] = chars[rand() % strlen(chars)];
+			continue;
+		}
+		memcpy(&out[i], "\xc3\xa9", 2); /* e with an acute accent */
+		i++;
+		length++;
+	}
+	out[length] = '\0';
+	return length;
+}
+
+int main(int argc, char *argv[]) {
+
+	struct arena arena;
+	struct entry *entries, *old;
+	size_t i, count;
+	double start, keys, sorted, reference;
+
+	count = argc > 1 ? strtoul(argv[1], NULL, 10) : NAMES;
+	memset(&arena, 0, sizeof(arena));
+	entries = malloc(count * sizeof(struct entry));
+	old = malloc(count * sizeof(struct entry));
+	if (!entries || !old) return 1;
+
+	srand(1);
+	start = clock_monotonic();
+	for (i = 0; i < count; i++) {
+		char name[64];
+		size_t length = random_name(name);
+		int ret;
+		memset(&entries[i], 0, sizeof(struct entry));
+		entries[i].length = length;
+		entries[i].type = rand() % 8 ? DT_REG : DT_DIR;
+		entries[i].name = arena_add(&arena, name, length);
+		if (entries[i].name == ARENA_ERR) return 1;
+		ret = sort_key(&arena, name, length);
+		if (ret < 0) return 1;
+		entries[i].key_length = ret;
+	}
+	keys = clock_elapsed(start);
+	memcpy(old, entries, count * sizeof(struct entry));
+
+	start = clock_monotonic();
+	sort_entries(entries, count, &arena);
+	sorted = clock_elapsed(start);
+
+	names = arena.data;
+	start = clock_monotonic();
+	qsort(old, count, sizeof(struct entry), compare);
+	reference = clock_elapsed(start);
+
+	for (i = 1; i < count; i++) {
+		if (compare(&entries[i - 1], &entries[i]) > 0) {
+			printf("sort: %s before %s\n",
+				&arena.data[entries[i - 1].name],
+				&arena.data[entries[i].name]);
+			return 1;
+		}
+	}
+	printf("sort: %lu names, keys %.2f s, sort %.2f s, "
+		"old comparator %.2f s\n", (unsigned long)count,
+		keys, sorted, reference);
+	free(entries);
+	free(old);
+	arena_free(&arena);
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "arena.h"
+#include "view.h"
+#include "file.h"
+#include "meta.h"
+#include "purge.h"
+#include "clock.h"
+
+/* Stats of a tree of empty files, directory by directory as a listing
+ * does, one by one, shared between 16 threads and batched through the
+ * io_uring, with the page cache warm then dropped. The cache is only
+ * dropped when run as root.
+ * usage: bench/stat [files] [directory] */
+
+#define FILES 1000000
+#define FILES_PER_DIR 1000
+#define DIRECTORY "/tmp/mz-bench-stat"
+
+/* drop the page cache and the cached inodes, returns -1 if not allowed */
+static int drop_caches(void) {
+	int fd, ret;
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0) return -1;
+	ret = write(fd, "3", 1) == 1 ? 0 : -1;
+	close(fd);
+	return ret;
+}
+
+/* stat the files of every directory, returns the number of errors */
+static size_t stat_tree(int root, struct meta *metas, size_t count) {
+	size_t i, j, n, errors;
+	char name[32];
+	int dir;
+
+	errors = 0;
+	for (i = 0; i < count; i += FILES_PER_DIR) {
+		n = count - i < FILES_PER_DIR ? count - i : FILES_PER_DIR;
+		sprintf(name, "dir%lu", (unsigned long)(i / FILES_PER_DIR));
+		dir = openat(root, name, O_DIRECTORY);
+		if (dir < 0) return count;
+		meta_stat(dir, metas, n, AT_SYMLINK_NOFOLLOW);
+		for (j = 0; j < n; j++)
+			if (metas[j].error) errors++;
+		close(dir);
+	}
+	return errors;
+}
+
+/* stat every file in a new process, the settings are read once */
+static void run(const char *mode, int root, struct meta *metas, size_t count,
+		int cold) {
+
+	double start, elapsed;
+	size_t errors;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) exit(1);
+	if (pid) {
+		waitpid(pid, NULL, 0);
+		return;
+	}
+	if (!strcmp(mode, "threads")) setenv("MZ_STAT_THREADS", "16", 1);
+	else setenv("MZ_STAT_THREADS", "1", 1);
+	if (!strcmp(mode, "io_uring")) setenv("MZ_STAT_RING", "1", 1);
+	else unsetenv("MZ_STAT_RING");
+	if (cold && drop_caches()) exit(0);
+	if (!cold) stat_tree(root, metas, count);
+
+	start = clock_monotonic();
+	errors = stat_tree(root, metas, count);
+	elapsed = clock_elapsed(start);
+	printf("stat: %s cache, %s: %.0f stats/s%s\n", cold ? "cold" : "warm",
+		mode, count / elapsed, errors ? " (with errors)" : "");
+	meta_free();
+	exit(0);
+}
+
+int main(int argc, char *argv[]) {
+
+	struct arena names;
+	struct meta metas[FILES_PER_DIR];
+	const char *path;
+	size_t i, count, offset;
+	int root, dir = -1;
+
+	count = argc > 1 ? strtoul(argv[1], NULL, 10) : FILES;
+	path = argc > 2 ? argv[2] : DIRECTORY;
+	memset(&names, 0, sizeof(names));
+	if (mkdir(path, 0755) && errno != EEXIST) return 1;
+	root = open(path, O_DIRECTORY);
+	if (root < 0) return 1;
+
+	/* every directory has the same names */
+	for (i = 0; i < FILES_PER_DIR; i++) {
+		char name[32];
+		int length = sprintf(name, "file%lu", (unsigned long)i);
+		if (arena_add(&names, name, length) == ARENA_ERR) return 1;
+	}
+	for (i = offset = 0; i < FILES_PER_DIR; i++) {
+		metas[i].name = &names.data[offset];
+		offset += strlen(metas[i].name) + 1;
+	}
+	for (i = 0; i < count; i++) {
+		int fd;
+		if (i % FILES_PER_DIR == 0) {
+			char name[32];
+			sprintf(name, "dir%lu", (unsigned long)(i / FILES_PER_DIR));
+			if (dir > -1) close(dir);
+			if (mkdirat(root, name, 0755) && errno != EEXIST)
+				return 1;
+			dir = openat(root, name, O_DIRECTORY);
+			if (dir < 0) return 1;
+		}
+		fd = openat(dir, metas[i % FILES_PER_DIR].name,
+				O_WRONLY|O_CREAT, 0644);
+		if (fd < 0) return 1;
+		close(fd);
+	}
+	if (dir > -1) close(dir);
+	fflush(stdout);
+
+	run("sequential", root, metas, count, 0);
+	run("threads", root, metas, count, 0);
+	run("io_uring", root, metas, count, 0);
+	run("sequential", root, metas, count, 1);
+	run("threads", root, metas, count, 1);
+	run("io_uring", root, metas, count, 1);
+
+	close(root);
+	purge_tree(path, 0, NULL);
+	arena_free(&names);
+	return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "view.h"
+#include "file.h"
+#include "index.h"
+#include "purge.h"
+#include "clock.h"
+
+/* Read of the index of a trash of many files: the conversion of the text
+ * index of the previous versions, which stats the missing trashed files
+ * once, then the replay of the index done by every listing.
+ * usage: bench/trash [files] [directory] */
+
+#define FILES 1000000
+#define DIRECTORY "/tmp/mz-bench-trash"
+#define LOADS 5
+
+/* write the text index, a line per file with its id and its path */
+static int fill(int dir, size_t count) {
+	FILE *f;
+	size_t i, j;
+	int fd;
+
+	fd = openat(dir, "info", O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0) return -1;
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		char id[INDEX_ID + 1];
+		unsigned long n = i;
+		for (j = 0; j < INDEX_ID; j++, n /= 26) id[j] = 'a' + n % 26;
+		id[INDEX_ID] = '\0';
+		fprintf(f, "%s /home/user/documents/project/file%lu.txt\n",
+			id, (unsigned long)i);
+	}
+	return fclose(f) ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+
+	struct index index;
+	const char *path;
+	double start, elapsed;
+	size_t count, i;
+	int dir;
+
+	count = argc > 1 ? strtoul(argv[1], NULL, 10) : FILES;
+	path = argc > 2 ? argv[2] : DIRECTORY;
+	if (mkdir(path, 0755) && errno != EEXIST) return 1;
+	dir = open(path, O_DIRECTORY);
+	if (dir < 0 || fill(dir, count)) return 1;
+
+	start = clock_monotonic();
+	if (index_init(dir, path)) {
+		printf("trash: conversion: %s\n", strerror(errno));
+		return 1;
+	}
+	elapsed = clock_elapsed(start);
+	printf("trash: conversion of %lu files: %.2f s\n",
+		(unsigned long)count, elapsed);
+
+	start = clock_monotonic();
+	for (i = 0; i < LOADS; i++) {
+		if (index_load(dir, &index)) {
+			printf("trash: load: %s\n", strerror(errno));
+			return 1;
+		}
+		if (index.count != count)
+			printf("trash: %lu files loaded\n",
+				(unsigned long)index.count);
+		index_free(&index);
+	}
+	elapsed = clock_elapsed(start);
+	printf("trash: load of %lu files: %.3f s\n", (unsigned long)count,
+		elapsed / LOADS);
+
+	close(dir);
+	purge_tree(path, 0, NULL);
+	return 0;
+}
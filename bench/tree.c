@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "view.h"
+#include "file.h"
+#include "util.h"
+#include "copy.h"
+#include "purge.h"
+#include "clock.h"
+
+/* Copy of a tree of small files by the usual per-file system calls then
+ * through the io_uring, on one thread then on several, with the page cache
+ * dropped before each copy when run as root.
+ * usage: bench/tree [files] [directory] */
+
+#define FILES 20000
+#define FILES_PER_DIR 10
+#define FILE_SIZE 500
+#define DIRECTORY "/tmp/mz-bench-tree"
+
+/* drop the page cache and the cached inodes, returns -1 if not allowed */
+static int drop_caches(void) {
+	int fd, ret;
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0) return -1;
+	ret = write(fd, "3", 1) == 1 ? 0 : -1;
+	close(fd);
+	return ret;
+}
+
+/* create count files of FILE_SIZE bytes in directories of FILES_PER_DIR */
+static int fill(const char *path, size_t count) {
+	char data[FILE_SIZE], name[PATH_MAX];
+	size_t i;
+	int fd;
+
+	memset(data, 'x', sizeof(data));
+	if (mkdir(path, 0755)) return -1;
+	for (i = 0; i < count; i++) {
+		if (i % FILES_PER_DIR == 0) {
+			snprintf(V(name), "%s/dir%lu", path,
+				(unsigned long)(i / FILES_PER_DIR));
+			if (mkdir(name, 0755)) return -1;
+		}
+		snprintf(V(name), "%s/dir%lu/file%lu", path,
+			(unsigned long)(i / FILES_PER_DIR), (unsigned long)i);
+		fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if (fd < 0) return -1;
+		if (write(fd, data, sizeof(data)) != sizeof(data)) {
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+	return 0;
+}
+
+/* copy the tree at path as name in dir with the given number of threads,
+ * through the ring if ring is "1" */
+static void run(const char *path, int dir, const char *name,
+		const char *threads, const char *ring) {
+
+	char copied[PATH_MAX];
+	struct copy copy;
+	double start, elapsed;
+	int ret;
+
+	memset(&copy, 0, sizeof(copy));
+	setenv("MZ_COPY_THREADS", threads, 1);
+	setenv("MZ_COPY_RING", ring, 1);
+	drop_caches();
+
+	start = clock_monotonic();
+	ret = copy_tree(path, dir, name, &copy);
+	if (!ret) ret = syncfs(dir);
+	elapsed = clock_elapsed(start);
+
+	if (ret) {
+		printf("tree: %s, %s threads: %s\n", *ring == '1' ?
+			"io_uring" : "per file", threads, strerror(errno));
+	} else {
+		printf("tree: %s, %s threads: %.0f files/s, %lu by io_uring\n",
+			*ring == '1' ? "io_uring" : "per file", threads,
+			copy.files / elapsed,
+			(unsigned long)copy.strategies[COPY_RING]);
+	}
+	snprintf(V(copied), "%s.copy", path);
+	purge_tree(copied, 0, NULL);
+}
+
+int main(int argc, char *argv[]) {
+
+	char parent[PATH_MAX], *name;
+	const char *path;
+	size_t count;
+	int dir;
+
+	copy_init();
+	count = argc > 1 ? strtoul(argv[1], NULL, 10) : FILES;
+	path = argc > 2 ? argv[2] : DIRECTORY;
+	snprintf(V(parent), "%s", path);
+	name = strrchr(parent, '/');
+	if (!name || !name[1]) return 1;
+	*name++ = '\0';
+	dir = open(*parent ? parent : "/", O_DIRECTORY);
+	if (dir < 0 || fill(path, count)) return 1;
+	name = strcat(name, ".copy");
+
+	run(path, dir, name, "1", "0");
+	run(path, dir, name, "1", "1");
+	run(path, dir, name, "4", "0");
+	run(path, dir, name, "4", "1");
+
+	close(dir);
+	purge_tree(path, 0, NULL);
+	return 0;
+}
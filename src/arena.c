@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_MIN 4096
+
+/* make room for length bytes and a null terminator at the end of the arena,
+ * the caller writes to the returned pointer and increases the length */
+char *arena_reserve(struct arena *arena, size_t length) {
+	if (arena->length + length + 1 > arena->size) {
+		size_t size = arena->size ? arena->size : ARENA_MIN;
+		void *ptr;
+		while (arena->length + length + 1 > size) size *= 2;
+		ptr = realloc(arena->data, size);
+		if (!ptr) return NULL;
+		arena->data = ptr;
+		arena->size = size;
+	}
+	return &arena->data[arena->length];
+}
+
+/* append a null-terminated copy of str and return its offset */
+size_t arena_add(struct arena *arena, const char *str, size_t length) {
+
+	size_t offset;
+
+	if (!arena_reserve(arena, length)) return ARENA_ERR;
+
+	offset = arena->length;
+	memcpy(&arena->data[offset], str, length);
+	arena->data[offset + length] = '\0';
+	arena->length += length + 1;
+	return offset;
+}
+
+void arena_free(struct arena *arena) {
+	free(arena->data);
+	arena->data = NULL;
+	arena->length = arena->size = 0;
+}
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "view.h"
+#include "file.h"
+#include "util.h"
+#include "strlcpy.h"
+#include "config.h"
+#include "cache.h"
+
+#define CACHE_BUCKETS 256
+#define CACHE_SIZE 64 /* default budget in megabytes */
+
+struct listing {
+	struct stamp stamp;
+	struct entry *entries;
+	size_t length;
+	size_t allocated;
+	size_t *index;
+	size_t count;
+	size_t unresolved;
+	struct arena names;
+	unsigned int selected;
+	int showhidden;
+	int showtype;
+	char filter[256];
+	double elapsed;
+	size_t size;
+	struct listing *prev; /* more recently used */
+	struct listing *next; /* less recently used */
+	struct listing *chain; /* next listing in the same bucket */
+};
+
+static struct {
+	struct listing *buckets[CACHE_BUCKETS];
+	struct listing *first;
+	struct listing *last;
+	size_t count;
+	size_t size;
+	size_t budget;
+	unsigned long hits;
+	unsigned long misses;
+	int init;
+} cache;
+
+static void cache_init(void) {
+	if (cache.init) return;
+	cache.budget = config_number("MZ_CACHE", CACHE_SIZE) * 1024 * 1024;
+	cache.init = 1;
+}
+
+static struct listing **cache_bucket(dev_t dev, ino_t ino) {
+	return &cache.buckets[(unsigned long)(dev ^ ino) % CACHE_BUCKETS];
+}
+
+/* A listing is valid if the directory was not modified after it was read.
+ * Timestamps only have a precision of one second on some systems, so a
+ * directory modified during the second the listing started is reread. */
+static int cache_valid(struct stamp *stamp, struct stat *st) {
+	return stamp->dev == st->st_dev && stamp->ino == st->st_ino &&
+		stamp->mtime == st->st_mtime && stamp->ctime == st->st_ctime &&
+		stamp->mtime < stamp->listed && stamp->ctime < stamp->listed;
+}
+
+static void cache_unlink(struct listing *listing) {
+
+	struct listing **ptr;
+
+	ptr = cache_bucket(listing->stamp.dev, listing->stamp.ino);
+	while (*ptr != listing) ptr = &(*ptr)->chain;
+	*ptr = listing->chain;
+
+	if (listing->prev) listing->prev->next = listing->next;
+	else cache.first = listing->next;
+	if (listing->next) listing->next->prev = listing->prev;
+	else cache.last = listing->prev;
+
+	cache.count--;
+	cache.size -= listing->size;
+}
+
+static void cache_release(struct listing *listing) {
+	free(listing->entries);
+	free(listing->index);
+	arena_free(&listing->names);
+	free(listing);
+}
+
+/* move the listing of the view into the cache, the view is left empty */
+void cache_put(struct view *view) {
+
+	struct listing *listing, **bucket;
+	size_t size;
+
+	cache_init();
+	if (view->loading || !view->entries || !view->stamp.listed) return;
+	size = sizeof(struct listing) + view->names.size +
+		view->allocated * (sizeof(struct entry) + sizeof(size_t));
+	if (size > cache.budget) return;
+
+	listing = malloc(sizeof(struct listing));
+	if (!listing) return;
+
+	/* replace an older listing of the same directory */
+	bucket = cache_bucket(view->stamp.dev, view->stamp.ino);
+	while (*bucket) {
+		struct listing *old = *bucket;
+		if (old->stamp.dev == view->stamp.dev &&
+				old->stamp.ino == view->stamp.ino) {
+			cache_unlink(old);
+			cache_release(old);
+			break;
+		}
+		bucket = &old->chain;
+	}
+
+	while (cache.size + size > cache.budget && cache.last) {
+		struct listing *old = cache.last;
+		cache_unlink(old);
+		cache_release(old);
+	}
+
+	listing->stamp = view->stamp;
+	listing->entries = view->entries;
+	listing->length = view->length;
+	listing->allocated = view->allocated;
+	listing->index = view->index;
+	listing->count = view->count;
+	listing->unresolved = view->unresolved;
+	listing->names = view->names;
+	listing->selected = view->selected;
+	listing->showhidden = view->showhidden;
+	listing->showtype = view->showtype;
+	STRCPY(listing->filter, view->filter);
+	listing->elapsed = view->elapsed;
+	listing->size = size;
+
+	bucket = cache_bucket(listing->stamp.dev, listing->stamp.ino);
+	listing->chain = *bucket;
+	*bucket = listing;
+	listing->prev = NULL;
+	listing->next = cache.first;
+	if (cache.first) cache.first->prev = listing;
+	cache.first = listing;
+	if (!cache.last) cache.last = listing;
+	cache.count++;
+	cache.size += size;
+
+	view->entries = NULL;
+	view->index = NULL;
+	view->length = view->allocated = view->count = 0;
+	view->unresolved = view->resolving = 0;
+	PZERO(&view->names);
+	PZERO(&view->stamp);
+}
+
+/* Give the view an up to date listing of its directory, st is the status of
+ * the directory. Returns 0 on success and -1 if it must be read again. */
+int cache_get(struct view *view, struct stat *st) {
+
+	struct listing *listing;
+
+	cache_init();
+
+	/* the view already has the listing */
+	if (!view->loading && view->entries && cache_valid(&view->stamp, st)) {
+		cache.hits++;
+		return 0;
+	}
+
+	listing = *cache_bucket(st->st_dev, st->st_ino);
+	while (listing) {
+		if (listing->stamp.dev == st->st_dev &&
+				listing->stamp.ino == st->st_ino)
+			break;
+		listing = listing->chain;
+	}
+	if (!listing) {
+		cache.misses++;
+		return -1;
+	}
+	cache_unlink(listing);
+	if (!cache_valid(&listing->stamp, st)) {
+		cache_release(listing);
+		cache.misses++;
+		return -1;
+	}
+
+	file_free(view);
+	view->stamp = listing->stamp;
+	view->entries = listing->entries;
+	view->length = listing->length;
+	view->allocated = listing->allocated;
+	view->index = listing->index;
+	view->count = listing->count;
+	view->unresolved = listing->unresolved;
+	view->resolving = 0;
+	view->names = listing->names;
+	view->elapsed = listing->elapsed;
+	view->selected = listing->selected;
+	view->scroll = 0;
+	/* the index is only reused if it was built with the same filters */
+	if (listing->showhidden != view->showhidden ||
+			listing->showtype != view->showtype ||
+			strcmp(listing->filter, view->filter))
+		file_filter(view, file_position(view));
+	free(listing);
+	cache.hits++;
+	return 0;
+}
+
+/* remember the status of the directory when the listing started */
+void cache_stamp(struct view *view, struct stat *st) {
+	view->stamp.dev = st->st_dev;
+	view->stamp.ino = st->st_ino;
+	view->stamp.mtime = st->st_mtime;
+	view->stamp.ctime = st->st_ctime;
+	view->stamp.listed = time(NULL);
+}
+
+void cache_stats(char *out, size_t length) {
+	cache_init();
+	snprintf(out, length,
+		"cache: %lu listings, %lu/%lu KiB, %lu hits, %lu misses",
+		(unsigned long)cache.count, (unsigned long)cache.size / 1024,
+		(unsigned long)cache.budget / 1024, cache.hits, cache.misses);
+}
+
+void cache_free(void) {
+	while (cache.last) {
+		struct listing *listing = cache.last;
+		cache_unlink(listing);
+		cache_release(listing);
+	}
+}
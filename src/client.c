@@ -24,7 +24,10 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "termbox.h"
+#include "arena.h"
 #include "view.h"
 #include "client.h"
 #include "file.h"
@@ -33,11 +36,17 @@
 #include "trash.h"
 #include "util.h"
 #include "spawn.h"
+#include "cache.h"
+#include "meta.h"
+#include "copy.h"
+#include "journal.h"
+#include "job.h"
 #ifdef HAS_INOTIFY
 #include <sys/inotify.h>
 #endif
 
 #define TAB_WIDTH_LIMIT 20
+#define JOB_REFRESH 500 /* milliseconds between redraws of a job progress */
 
 struct client client;
 
@@ -46,6 +55,108 @@ static void display_errno(void) {
 	client.error = 1;
 }
 
+/* tell what was pasted and how the files were copied */
+static void client_copied(struct copy *copy) {
+	static const char *strategies[COPY_STRATEGIES] = {
+		"cloned", "copy_file_range", "read/write", "io_uring"
+	};
+	size_t i, length;
+	length = snprintf(V(client.info),
+			"pasted %lu files, %.1f MiB (%.1f MiB transferred):",
+			(unsigned long)copy->files,
+			(double)copy->bytes / (1024 * 1024),
+			(double)copy->transferred / (1024 * 1024));
+	for (i = 0; i < COPY_STRATEGIES && length < sizeof(client.info); i++) {
+		if (!copy->strategies[i]) continue;
+		length += snprintf(&client.info[length],
+				sizeof(client.info) - length, " %lu %s,",
+				(unsigned long)copy->strategies[i],
+				strategies[i]);
+	}
+	if (copy->resumed && length < sizeof(client.info))
+		length += snprintf(&client.info[length],
+				sizeof(client.info) - length,
+				" %lu already copied,",
+				(unsigned long)copy->resumed);
+	if (copy->linked && length < sizeof(client.info))
+		length += snprintf(&client.info[length],
+				sizeof(client.info) - length,
+				" %lu hard links (%.1f MiB saved),",
+				(unsigned long)copy->linked,
+				(double)copy->saved / (1024 * 1024));
+	if (length >= sizeof(client.info)) length = sizeof(client.info) - 1;
+	client.info[length - 1] = '\0';
+	client.error = -1; /* not an error but a message */
+}
+
+/* remove the files set aside from the trashes in the background */
+static void client_purge(struct arena *asides) {
+	struct job *job;
+	size_t i;
+	if (!asides->length) {
+		arena_free(asides);
+		return;
+	}
+	job = job_new(JOB_PURGE, "/", "");
+	for (i = 0; job && i < asides->length;
+			i += strlen(&asides->data[i]) + 1) {
+		if (job_add(job, &asides->data[i])) {
+			job_discard(job);
+			job = NULL;
+		}
+	}
+	arena_free(asides);
+	if (!job || job_submit(job) < 0) {
+		job_discard(job);
+		display_errno();
+	}
+}
+
+/* purge the oldest files of the trashes over their quota or age limit */
+static void client_expire(void) {
+	struct arena asides;
+	memset(&asides, 0, sizeof(asides));
+	if (trash_expire(&asides)) display_errno();
+	client_purge(&asides);
+}
+
+/* tell how the jobs that ended went and show their result */
+static void client_ended(struct view *view) {
+	static const char *done[] = {"pasted", "moved", "deleted"};
+	struct job *job;
+	int ended = 0, deleted = 0;
+	while ((job = job_ended())) {
+		ended = 1;
+		if (job->type == JOB_DELETE) deleted = 1;
+		if (job->state == JOB_FAILED) {
+			errno = job->error;
+			display_errno();
+		} else if (job->state == JOB_CANCELLED) {
+			snprintf(V(client.info), "job %d cancelled", job->id);
+			client.error = -1;
+		} else if (job->type == JOB_COPY) {
+			struct copy copy;
+			copy_read(&job->copy, &copy);
+			client_copied(&copy);
+		} else if (job->type >= JOB_PURGE) {
+			struct copy copy;
+			copy_read(&job->copy, &copy);
+			snprintf(V(client.info),
+				"trash purged: %lu files, %.1f MiB freed",
+				(unsigned long)copy.files,
+				(double)copy.bytes / (1024 * 1024));
+			client.error = -1;
+		} else {
+			snprintf(V(client.info), "%s %lu entries",
+					done[job->type],
+					(unsigned long)job->done);
+			client.error = -1;
+		}
+	}
+	if (deleted) client_expire();
+	if (ended && file_reload(view)) display_errno();
+}
+
 static int display_tab(struct view *view, int x) {
 	char *ptr;
 	size_t length;
@@ -76,13 +187,17 @@ static int name_length(struct view *view) {
 
 int client_init(void) {
 
+	size_t interrupted;
+
 	PZERO(&client);
 
 	client.view = view_init(getenv("PWD"));
 	if (!client.view || file_ls(client.view)) return -1;
 
+	copy_init();
 	client.trash = trash_init();
 	if (client.trash < 0) return -1;
+	client_expire();
 
 #ifdef HAS_INOTIFY
 	if ((client.inotify_fd = inotify_init()) < 0) return -1;
@@ -94,12 +209,23 @@ int client_init(void) {
 
 	setenv("EDITOR", "vi", 0);
 
+	if ((interrupted = journal_count())) {
+		snprintf(V(client.info), "%lu interrupted copies, "
+				":resume to continue them or :resume discard",
+				(unsigned long)interrupted);
+		client.error = -1;
+	}
+
 	return 0;
 }
 
 int client_clean(void) {
+	job_free();
 	free(client.copy);
+	arena_free(&client.copy_names);
 	free(client.view);
+	cache_free();
+	meta_free();
 #ifdef HAS_INOTIFY
 	close(client.inotify_fd);
 #endif
@@ -185,7 +311,7 @@ draw:
 
 int client_update(void) {
 
-        char counter[32];
+        char counter[32], status[64], progress[128];
         struct view *view = client.view;
 	size_t i;
 
@@ -221,7 +347,7 @@ int client_update(void) {
 
 	/* display input field, error and counter */
         tb_print(0, client.height - 1, TB_DEFAULT,
-                client.error ? TB_RED : TB_DEFAULT,
+                client.error > 0 ? TB_RED : TB_DEFAULT,
                 client.error ? client.info : client.field);
 
         snprintf(V(counter), "%d", client.counter);
@@ -236,6 +362,33 @@ int client_update(void) {
 		i++;
 	}
         tb_print(0, client.height - 2, TB_BLACK, TB_WHITE, view->path);
+	if (view->loading)
+		snprintf(V(status), "%lu entries  loading...",
+				(unsigned long)view->length);
+	else if (view->count != view->length)
+		snprintf(V(status), "%lu/%lu entries  %.1f ms",
+				(unsigned long)view->count,
+				(unsigned long)view->length,
+				view->elapsed * 1000);
+	else
+		snprintf(V(status), "%lu entries  %.1f ms",
+				(unsigned long)view->length,
+				view->elapsed * 1000);
+	if (view->fd == TRASH_FD) {
+		i = strnlen(V(status));
+		snprintf(&status[i], sizeof(status) - i, "  %.1f MiB",
+				(double)trash_size() / (1024 * 1024));
+	}
+	i = strnlen(V(status));
+	if (i < client.width)
+		tb_print(client.width - i, client.height - 2,
+				TB_BLACK, TB_WHITE, status);
+	if (job_status(V(progress))) {
+		i += strnlen(V(progress)) + 2;
+		if (i < client.width)
+			tb_print(client.width - i, client.height - 2,
+					TB_BLACK, TB_WHITE, progress);
+	}
 
 	/* display tabs bar if there's more than one tab */
 	if (TABS)
@@ -305,6 +458,8 @@ static int closetab(void) {
 
 	if (view->fd > 0)
 		close(view->fd);
+	if (view->fd != TRASH_FD)
+		cache_put(view);
 	file_free(view);
 	free(view);
 	return client.view == NULL;
@@ -365,8 +520,75 @@ int parse_command(void) {
 		else addtab(v);
 		return 0;
 	}
+	if (!STRCMP(client.field, ":filter") ||
+			STARTWITH(client.field, ":filter ")) {
+		struct view *view = client.view;
+		const char *pattern = &client.field[sizeof(":filter") - 1];
+		if (*pattern) pattern++;
+		STRCPY(view->filter, pattern);
+		if (file_filter(view, file_position(view))) display_errno();
+		return 0;
+	}
+	if (!STRCMP(client.field, ":type") ||
+			STARTWITH(client.field, ":type ")) {
+		struct view *view = client.view;
+		const char *type = &client.field[sizeof(":type") - 1];
+		if (*type) type++;
+		if (!*type) view->showtype = 0;
+		else if (!strcmp(type, "d")) view->showtype = FILTER_DIRS;
+		else if (!strcmp(type, "f")) view->showtype = FILTER_FILES;
+		else {
+			snprintf(V(client.info), "Invalid type: %s", type);
+			client.error = 1;
+			return 0;
+		}
+		if (file_filter(view, file_position(view))) display_errno();
+		return 0;
+	}
+	if (!STRCMP(client.field, ":cache")) {
+		cache_stats(V(client.info));
+		client.error = -1; /* not an error but a message */
+		return 0;
+	}
+	if (!STRCMP(client.field, ":jobs")) {
+		job_list(V(client.info));
+		client.error = -1; /* not an error but a message */
+		return 0;
+	}
+	if (STARTWITH(client.field, ":jobs ")) {
+		static const char *actions[] = {"pause", "resume", "cancel"};
+		char action[16];
+		int id = 0;
+		size_t i;
+		if (sscanf(&client.field[sizeof(":jobs")], "%15s %d",
+				action, &id) < 1)
+			*action = '\0';
+		for (i = 0; i < LENGTH(actions); i++)
+			if (!strcmp(action, actions[i])) break;
+		if (i == LENGTH(actions)) {
+			snprintf(V(client.info), "Invalid action: %s", action);
+			client.error = 1;
+			return 0;
+		}
+		if (job_control(id, i)) display_errno();
+		return 0;
+	}
+	if (!STRCMP(client.field, ":resume")) {
+		int count = job_resume();
+		snprintf(V(client.info), "%d interrupted copies resumed", count);
+		client.error = -1;
+		return 0;
+	}
+	if (!STRCMP(client.field, ":resume discard")) {
+		if (journal_discard()) display_errno();
+		return 0;
+	}
 	if (!STRCMP(client.field, ":trash clear")) {
-		if (trash_clear()) display_errno();
+		struct job *job = job_new(JOB_CLEAR, "/", "");
+		if (!job || job_submit(job) < 0) {
+			job_discard(job);
+			display_errno();
+		}
 		return 0;
 	}
 
@@ -381,7 +603,7 @@ static void client_select(int next) {
 	size_t i;
 	int reset;
 
-	if (view->length < 1 || !*client.search)
+	if (view->count < 1 || !*client.search)
 		return;
 
 	reset = 0;
@@ -389,16 +611,16 @@ static void client_select(int next) {
 	i = view->selected + next;
 	while (i != view->selected || !next) {
 		if (!next) next = 1;
-		if (i >= view->length) {
+		if (i >= view->count) {
 			i = 0;
 			if (reset) break;
 			reset = 1;
 		}
-		if (strcasestr(view->entries[i].name, client.search)) {
+		if (strcasestr(NAME(view, ENTRY(view, i)), client.search)) {
 			view->selected = i;
 			break;
 		}
-		if (next < 0 && i == 0) i = view->length;
+		if (next < 0 && i == 0) i = view->count;
 		i += next;
 	}
 }
@@ -458,6 +680,56 @@ static int text_mode(int mode)  {
 	return 0;
 }
 
+#ifdef HAS_INOTIFY
+#define INOTIFY_BUFFER (64 * 1024)
+#define INOTIFY_CHANGES 1024
+
+/* read the pending inotify events and apply them to the view */
+static int client_inotify(struct view *view) {
+
+	static long events[INOTIFY_BUFFER / sizeof(long)]; /* aligned */
+	char *buf = (char*)events;
+	struct change changes[INOTIFY_CHANGES];
+	size_t length;
+	ssize_t len, i;
+	int overflow;
+
+	len = read(client.inotify_fd, buf, sizeof(events));
+	if (len <= 0) {
+		close(client.inotify_fd);
+		client.inotify_fd = -1;
+		*client.watch = 0;
+		return -1;
+	}
+
+	overflow = 0;
+	length = 0;
+	for (i = 0; i < len; ) {
+		struct inotify_event *event = (void*)&buf[i];
+		i += sizeof(struct inotify_event) + event->len;
+		if (event->mask & IN_Q_OVERFLOW) {
+			overflow = 1;
+			break;
+		}
+		if (event->wd != client.inotify_watch || !event->len)
+			continue;
+		if (length >= LENGTH(changes)) {
+			if (file_update(view, changes, length)) return -1;
+			length = 0;
+		}
+		changes[length].name = event->name;
+		changes[length].created = event->mask & (IN_CREATE|IN_MOVED_TO);
+		changes[length].dir = event->mask & IN_ISDIR;
+		length++;
+	}
+
+	if (view->fd == TRASH_FD) return 0;
+	/* some events were lost, the directory must be read again */
+	if (overflow) return file_reload(view);
+	return file_update(view, changes, length);
+}
+#endif
+
 int client_input(void) {
 
 	struct tb_event ev;
@@ -470,7 +742,24 @@ int client_input(void) {
 	const int fd = -1;
 #endif
 
-	ret = tb_poll_event(&ev, fd);
+	/* keep reading the directory and resolving the type of its
+	 * entries between key presses, the shown entries first */
+	if (view->loading || view->unresolved) {
+		ret = tb_peek_event(&ev, 0, fd, job_fd());
+		if (ret == TB_ERR_NO_EVENT) {
+			if (file_load(view) < 0 ||
+				file_resolve(view, view->scroll, HEIGHT + 1) ||
+				file_resolve_next(view) < 0)
+				display_errno();
+			return 0;
+		}
+	} else if (job_active()) {
+		/* wake up to redraw the progress of the running job */
+		ret = tb_peek_event(&ev, JOB_REFRESH, fd, job_fd());
+		if (ret == TB_ERR_NO_EVENT) return 0;
+	} else {
+		ret = tb_poll_event(&ev, fd, job_fd());
+	}
 	if (ret == TB_ERR_INOTIFY) {
 		client.inotify_fd = -1;
 		inotify_init();
@@ -486,10 +775,13 @@ int client_input(void) {
 		return 0;
 	case TB_EVENT_KEY:
 		break;
+	case TB_EVENT_JOB:
+		client_ended(view);
+		return 0;
 #ifdef HAS_INOTIFY
 	case TB_EVENT_INOTIFY:
-		file_reload(view);
-		break;
+		if (client_inotify(view)) display_errno();
+		return 0;
 #endif
 	default:
 		return 0;
@@ -538,7 +830,7 @@ int client_input(void) {
 
 	switch (ev.ch) {
 	case 'j':
-		ADDMAX(view->selected, AZ(client.counter), view->length - 1);
+		ADDMAX(view->selected, AZ(client.counter), view->count - 1);
 		client.counter = 0;
 		break;
 	case 'k':
@@ -582,7 +874,7 @@ open:
 		break;
 	case '.':
 		TOGGLE(view->showhidden);
-		file_ls(view);
+		if (file_filter(view, file_position(view))) display_errno();
 		break;
 	case '/': /* search */
 	case ':': /* command */
@@ -599,6 +891,10 @@ open:
 		client_select(-1);
 		break;
 	case 'e':
+		if (file_resolve(view, view->selected, 1)) {
+			display_errno();
+			break;
+		}
 		if (EMPTY(view) || SELECTED(view).type == DT_DIR)
 			break;
 	{
@@ -607,7 +903,7 @@ open:
 			if (trash_rawpath(view, V(buf))) break;
 		} else {
 			snprintf(V(buf), "%s/%s",
-				view->path, SELECTED(view).name);
+				view->path, NAME(view, SELECTED(view)));
 			if (chdir(view->path)) {
 				display_errno();
 				break;
@@ -621,7 +917,7 @@ open:
 	}
 		break;
 	case 'G':
-		view->selected = view->length - 1;
+		view->selected = view->count - 1;
 		break;
 	case 'g':
 		if (client.g) {
@@ -639,66 +935,90 @@ open:
 		break;
 	case 'd': /* delete (move to trash) */
 	{
+		struct job *job;
 		size_t i = 0;
 		if (view->fd == TRASH_FD) break;
-		while (i < view->length) {
-			size_t j = i++;
-			if (!view->entries[j].selected) continue;
-			if (trash_send(view->fd, view->path,
-					view->entries[j].name)) {
-				display_errno();
-				view_unselect(view);
-				break;
+		job = job_new(JOB_DELETE, view->path, "");
+		while (job && i < view->count) {
+			struct entry *e = &ENTRY(view, i++);
+			if (!e->selected) continue;
+			if (job_add(job, NAME(view, *e))) {
+				job_discard(job);
+				job = NULL;
 			}
-			view->entries[j].selected = 0;
 		}
+		if (job && !job->length) {
+			job_discard(job);
+			break;
+		}
+		if (!job || job_submit(job) < 0) {
+			job_discard(job);
+			display_errno();
+			break;
+		}
+		view_unselect(view);
 	}
-		file_ls(view);
-		if (view->selected >= view->length)
-			view->selected = view->length - 1;
 		break;
 	case 'p': /* paste */
+	{
+		struct job *job;
+		int id = -1;
 		if (!client.copy_length) break;
-		i = 0;
-		while (i < client.copy_length) {
-			if (client.cut ?
-				file_move_entry(view, &client.copy[i]) :
-				file_copy_entry(view, &client.copy[i]))
-				display_errno();
-			i++;
+		job = job_new(client.cut ? JOB_MOVE : JOB_COPY,
+				client.copy_path, view->path);
+		for (i = 0; job && i < client.copy_length; i++) {
+			if (job_add(job, &client.copy_names.data[
+						client.copy[i].name])) {
+				job_discard(job);
+				job = NULL;
+			}
+		}
+		if (!job || (id = job_submit(job)) < 0) {
+			job_discard(job);
+			display_errno();
+			break;
 		}
+		snprintf(V(client.info), "job %d queued", id);
+		client.error = -1;
+	}
 		free(client.copy);
+		arena_free(&client.copy_names);
 		client.copy = NULL;
 		client.copy_length = 0;
-		file_ls(view);
-		file_reload(view);
 		break;
 	case 'x': /* cut */
 	case 'c': /* copy */
 	{
 		size_t i = 0, j = 0, length = 0;
-		while (i < view->length) {
-			if (view->entries[i].selected) length++;
+		while (i < view->count) {
+			if (ENTRY(view, i).selected) length++;
 			i++;
 		}
 		if (!length) break;
 		free(client.copy);
+		arena_free(&client.copy_names);
+		client.copy_length = 0;
 		client.copy = malloc(sizeof(struct entry) * length);
 		if (!client.copy) {
 			display_errno();
 			break;
 		}
 		STRCPY(client.copy_path, view->path);
-		client.copy_length = length;
 		i = 0;
-		while (i < view->length) {
-			if (view->entries[i].selected) {
-				client.copy[j] = view->entries[i];
-				view->entries[i].selected = 0;
-				j++;
+		while (i < view->count) {
+			struct entry *e = &ENTRY(view, i++);
+			if (!e->selected) continue;
+			client.copy[j] = *e;
+			client.copy[j].name = arena_add(&client.copy_names,
+						NAME(view, *e), e->length);
+			if (client.copy[j].name == ARENA_ERR) {
+				display_errno();
+				break;
 			}
-			i++;
+			e->selected = 0;
+			j++;
 		}
+		client.copy_length = j;
 		client.cut = ev.ch == 'x';
 	}
 		break;
@@ -714,7 +1034,7 @@ open:
 		client.y = 0;
 		if (!spawn("xclip", 1, 1, "-v", NULL)) {
 			snprintf(V(buf), "%s/%s",
-				view->path, SELECTED(view).name);
+				view->path, NAME(view, SELECTED(view)));
 			if (spawn_pipe("xclip", buf, 1, 1,
 						"-sel", "clip", NULL)) {
 				display_errno();
@@ -722,7 +1042,7 @@ open:
 			}
 		} else if (!spawn("wl-copy", 1, 1, "-v", NULL)) {
 			snprintf(V(buf), "%s/%s",
-				view->path, SELECTED(view).name);
+				view->path, NAME(view, SELECTED(view)));
 			if (spawn_pipe("wl-copy", buf, 1, 0, NULL)) {
 				display_errno();
 				break;
@@ -730,7 +1050,7 @@ open:
 		}
 		if (getenv("TMUX")) { /* try tmux if no xclip */
 			snprintf(V(buf), "%s/%s",
-				view->path, SELECTED(view).name);
+				view->path, NAME(view, SELECTED(view)));
 			if (spawn_pipe("tmux", buf, 1, 1, "load-buffer",
 						"-", NULL) == -1) {
 				display_errno();
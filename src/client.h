@@ -31,6 +31,7 @@ enum {
 struct client {
 	struct view *view;
 	struct entry *copy;
+	struct arena copy_names;
 	char copy_path[1024];
 	size_t copy_length;
 	size_t width;
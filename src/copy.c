@@ -0,0 +1,1410 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fts.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "arena.h"
+#include "view.h"
+#include "file.h"
+#include "util.h"
+#include "config.h"
+#include "ring.h"
+#include "journal.h"
+#include "copy.h"
+#ifdef HAS_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#ifdef __linux__
+#define pread pread64
+#define pwrite pwrite64
+#define ftruncate ftruncate64
+#define lseek lseek64
+#define fallocate fallocate64
+#define posix_fadvise posix_fadvise64
+#define off_t off64_t
+#endif
+
+#define COPY_THREADS 4 /* default number of threads copying files */
+#define COPY_THREADS_MAX 64
+#define CHUNK_SIZE 64 /* default size of the ranges of a file in megabytes */
+#define CHUNK_THREADS 4 /* default number of threads copying a file */
+#define BUFFER_MIN (1024 * 1024) /* of the buffers of the read and write loop */
+#define BUFFER_MAX (16 * 1024 * 1024)
+#define BUFFER_ALIGN 4096 /* of the buffers and offsets of direct I/O */
+#define CACHE_BYPASS (32 * 1024 * 1024) /* larger copies are not cached */
+#define PARTIAL ".mz-part" /* suffix of the files being copied */
+#define SMALL_FILE (64 * 1024) /* files read in a single request */
+#define RING_FILES 64 /* small files copied at once by the ring */
+#define RING_MIN 16 /* small files needed to set up a ring */
+#define RING_PENDING INT_MIN /* result of a request that did not complete */
+#if defined(HAS_IO_URING) && defined(IORING_FEAT_EXT_ARG) && \
+	defined(RENAME_NOREPLACE)
+#define HAS_RING_RENAME /* the headers of 5.11 added IORING_OP_RENAMEAT */
+#endif
+
+#if !defined(__linux__) && !defined(__FreeBSD__)
+#define NO_COPY_FILE_RANGE
+#endif
+
+/* ranges of a file copied concurrently */
+struct chunks {
+	int src;
+	int dst;
+	off_t length;
+	off_t size; /* of a range */
+	off_t next; /* start of the next range to copy */
+	int usebuf; /* copy_file_range can't be used */
+	int allocated; /* the blocks of the destination were reserved */
+	int sparse; /* only copy the data regions */
+	size_t buffer; /* size of the buffers of the read and write loop */
+	int bypass; /* drop the copied ranges from the page cache */
+	int direct; /* the loop may bypass the page cache with O_DIRECT */
+	int directed; /* 1 once O_DIRECT is set, -1 if it is unsupported */
+	int strategy;
+	int error;
+	struct copy *copy;
+	struct journal *journal; /* records the ranges copied if not NULL */
+	const char *path; /* of the copy, relative to the destination */
+	pthread_mutex_t lock;
+};
+
+/* file or directory of the tree, its path is relative to the source */
+struct node {
+	size_t path; /* offset in the arena, empty for the root */
+	mode_t mode;
+	off_t size;
+};
+
+/* file with several links, the next ones are linked to its copy */
+struct inode {
+	dev_t dev;
+	ino_t ino;
+	size_t path; /* of its first link in the arena */
+	size_t next; /* position + 1 of the next inode of the bucket */
+};
+
+/* file whose inode was already met */
+struct link {
+	struct node node;
+	size_t target; /* path of the first link in the arena */
+};
+
+struct tree {
+	const char *src; /* path of the source */
+	int dstdir;
+	const char *name; /* name of the copy in dstdir */
+	struct node *files;
+	size_t length;
+	size_t allocated;
+	struct node *small; /* files of at most SMALL_FILE bytes */
+	size_t small_length;
+	size_t small_allocated;
+	size_t small_next;
+	mode_t umask;
+	struct node *dirs;
+	size_t dirs_length;
+	size_t dirs_allocated;
+	struct arena paths;
+	struct inode *inodes;
+	size_t inodes_length;
+	size_t *buckets; /* position + 1 of the first inode of each bucket */
+	size_t buckets_length;
+	struct link *links;
+	size_t links_length;
+	size_t links_allocated;
+	size_t next; /* next file to copy */
+	struct journal *journal;
+	int resumed; /* what was copied before an interruption is skipped */
+	int cancelled;
+	int error; /* errno of the first failure */
+	struct copy *copy;
+	pthread_mutex_t lock;
+};
+
+/* buffer of the read and write loop of a thread, kept between files */
+struct buffer {
+	char *data;
+	size_t size;
+};
+
+static pthread_key_t buffers;
+static pthread_once_t buffers_once = PTHREAD_ONCE_INIT;
+static int buffers_keyed;
+
+/* read once by the main thread, umask can't be read without changing it */
+static mode_t creation_mask;
+
+/* the progress of the copies is read and controlled by the main thread */
+static pthread_mutex_t progress = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resumed = PTHREAD_COND_INITIALIZER;
+
+void copy_bytes(struct copy *copy, size_t bytes, size_t transferred) {
+	if (!copy) return;
+	pthread_mutex_lock(&progress);
+	copy->bytes += bytes;
+	copy->transferred += transferred;
+	pthread_mutex_unlock(&progress);
+}
+
+/* a file was copied with the given strategy */
+void copy_done(struct copy *copy, int strategy) {
+	if (!copy) return;
+	pthread_mutex_lock(&progress);
+	copy->files++;
+	copy->strategies[strategy]++;
+	pthread_mutex_unlock(&progress);
+}
+
+/* a file was copied before the copy was interrupted */
+void copy_resumed(struct copy *copy, size_t bytes) {
+	if (!copy) return;
+	pthread_mutex_lock(&progress);
+	copy->files++;
+	copy->resumed++;
+	copy->bytes += bytes;
+	pthread_mutex_unlock(&progress);
+}
+
+/* name of the copy of path while it is incomplete */
+int copy_partial(const char *path, char *out, size_t length) {
+	if (snprintf(out, length, "%s" PARTIAL, path) < (int)length) return 0;
+	errno = ENAMETOOLONG;
+	return -1;
+}
+
+/* Give its name to the complete copy at partial, a file created there since
+ * the copy started is never replaced. The partial copy is removed if it
+ * can't be renamed. */
+int copy_rename(int dir, const char *partial, const char *path) {
+	struct stat st;
+	int error;
+#if defined(SYS_renameat2) && defined(RENAME_NOREPLACE)
+	if (!syscall(SYS_renameat2, dir, partial, dir, path, RENAME_NOREPLACE))
+		return 0;
+	if (errno != EINVAL && errno != ENOSYS) goto fail;
+#endif
+	/* the file system can't refuse to replace it */
+	if (!fstatat(dir, path, &st, AT_SYMLINK_NOFOLLOW)) {
+		errno = EEXIST;
+		goto fail;
+	}
+	if (!renameat(dir, partial, dir, path)) return 0;
+fail:
+	error = errno;
+	unlinkat(dir, partial, 0);
+	errno = error;
+	return -1;
+}
+
+/* a file was linked to the copy of another link of its inode */
+void copy_linked(struct copy *copy, size_t bytes) {
+	if (!copy) return;
+	pthread_mutex_lock(&progress);
+	copy->files++;
+	copy->linked++;
+	copy->saved += bytes;
+	copy->bytes += bytes;
+	pthread_mutex_unlock(&progress);
+}
+
+/* files were removed, freeing bytes */
+void copy_removed(struct copy *copy, size_t files, size_t bytes) {
+	if (!copy) return;
+	pthread_mutex_lock(&progress);
+	copy->files += files;
+	copy->bytes += bytes;
+	pthread_mutex_unlock(&progress);
+}
+
+void copy_dir(struct copy *copy) {
+	if (!copy) return;
+	pthread_mutex_lock(&progress);
+	copy->dirs++;
+	pthread_mutex_unlock(&progress);
+}
+
+void copy_init(void) {
+	creation_mask = umask(0);
+	umask(creation_mask);
+}
+
+/* Called between two files or two ranges, blocks while the copy is paused.
+ * Returns -1 with errno set to ECANCELED if the copy was cancelled. */
+int copy_wait(struct copy *copy) {
+	int cancelled;
+	if (!copy) return 0;
+	pthread_mutex_lock(&progress);
+	while (copy->paused && !copy->cancelled)
+		pthread_cond_wait(&resumed, &progress);
+	cancelled = copy->cancelled;
+	pthread_mutex_unlock(&progress);
+	if (!cancelled) return 0;
+	errno = ECANCELED;
+	return -1;
+}
+
+void copy_control(struct copy *copy, int paused, int cancelled) {
+	pthread_mutex_lock(&progress);
+	copy->paused = paused;
+	copy->cancelled = cancelled;
+	pthread_cond_broadcast(&resumed);
+	pthread_mutex_unlock(&progress);
+}
+
+int copy_cancelled(struct copy *copy) {
+	int cancelled;
+	if (!copy) return 0;
+	pthread_mutex_lock(&progress);
+	cancelled = copy->cancelled;
+	pthread_mutex_unlock(&progress);
+	return cancelled;
+}
+
+/* the partial files of the copy are kept to resume it */
+int copy_interrupted(struct copy *copy) {
+	int interrupted;
+	if (!copy) return 0;
+	pthread_mutex_lock(&progress);
+	interrupted = copy->cancelled == COPY_INTERRUPTED && copy->journal;
+	pthread_mutex_unlock(&progress);
+	return interrupted;
+}
+
+/* consistent copy of the progress */
+void copy_read(struct copy *copy, struct copy *out) {
+	pthread_mutex_lock(&progress);
+	*out = *copy;
+	pthread_mutex_unlock(&progress);
+}
+
+static int copy_add(struct tree *tree, struct node **nodes, size_t *length,
+			size_t *allocated, const char *path, struct stat *st) {
+	struct node *node;
+	if (*length >= *allocated) {
+		size_t size = *allocated ? *allocated * 2 : 256;
+		void *ptr = realloc(*nodes, size * sizeof(struct node));
+		if (!ptr) return -1;
+		*nodes = ptr;
+		*allocated = size;
+	}
+	node = &(*nodes)[*length];
+	node->path = arena_add(&tree->paths, path, strlen(path));
+	if (node->path == ARENA_ERR) return -1;
+	node->mode = st->st_mode;
+	node->size = st->st_size;
+	(*length)++;
+	return 0;
+}
+
+static size_t *copy_bucket(struct tree *tree, dev_t dev, ino_t ino) {
+	return &tree->buckets[(unsigned long)(dev ^ ino) % tree->buckets_length];
+}
+
+/* first link met of the inode of st, NULL if there's none */
+static struct inode *copy_inode(struct tree *tree, struct stat *st) {
+	size_t i;
+	if (!tree->buckets_length) return NULL;
+	for (i = *copy_bucket(tree, st->st_dev, st->st_ino); i;
+			i = tree->inodes[i - 1].next) {
+		struct inode *inode = &tree->inodes[i - 1];
+		if (inode->dev == st->st_dev && inode->ino == st->st_ino)
+			return inode;
+	}
+	return NULL;
+}
+
+/* remember the inode of a file with several links, the table grows with
+ * the number of inodes */
+static int copy_remember(struct tree *tree, struct stat *st, size_t path) {
+
+	struct inode *inode;
+	size_t *bucket, i;
+
+	if (tree->inodes_length >= tree->buckets_length) {
+		size_t length = tree->buckets_length ?
+				tree->buckets_length * 2 : 256;
+		void *ptr = realloc(tree->inodes,
+				length * sizeof(struct inode));
+		if (!ptr) return -1;
+		tree->inodes = ptr;
+		ptr = realloc(tree->buckets, length * sizeof(size_t));
+		if (!ptr) return -1;
+		tree->buckets = ptr;
+		tree->buckets_length = length;
+		memset(tree->buckets, 0, length * sizeof(size_t));
+		for (i = 0; i < tree->inodes_length; i++) {
+			inode = &tree->inodes[i];
+			bucket = copy_bucket(tree, inode->dev, inode->ino);
+			inode->next = *bucket;
+			*bucket = i + 1;
+		}
+	}
+	inode = &tree->inodes[tree->inodes_length];
+	inode->dev = st->st_dev;
+	inode->ino = st->st_ino;
+	inode->path = path;
+	bucket = copy_bucket(tree, st->st_dev, st->st_ino);
+	inode->next = *bucket;
+	*bucket = ++tree->inodes_length;
+	return 0;
+}
+
+static int copy_link(struct tree *tree, const char *path, struct stat *st,
+			size_t target) {
+	struct link *link;
+	if (tree->links_length >= tree->links_allocated) {
+		size_t size = tree->links_allocated ?
+				tree->links_allocated * 2 : 256;
+		void *ptr = realloc(tree->links, size * sizeof(struct link));
+		if (!ptr) return -1;
+		tree->links = ptr;
+		tree->links_allocated = size;
+	}
+	link = &tree->links[tree->links_length];
+	link->node.path = arena_add(&tree->paths, path, strlen(path));
+	if (link->node.path == ARENA_ERR) return -1;
+	link->node.mode = st->st_mode;
+	link->node.size = st->st_size;
+	link->target = target;
+	tree->links_length++;
+	return 0;
+}
+
+/* A file is listed to be copied unless another link to its inode was
+ * met, it is then linked to that copy once the files are copied. */
+static int copy_list(struct tree *tree, const char *path, const char *dst,
+			struct stat *st) {
+
+	struct inode *inode;
+	size_t offset;
+
+	if (st->st_nlink > 1 && (inode = copy_inode(tree, st)))
+		return copy_link(tree, path, st, inode->path);
+
+	if (journal_finished(tree->journal, dst)) {
+		copy_resumed(tree->copy, st->st_size);
+		if (st->st_nlink < 2) return 0;
+		offset = arena_add(&tree->paths, path, strlen(path));
+		if (offset == ARENA_ERR) return -1;
+	} else if (st->st_size <= SMALL_FILE) {
+		if (copy_add(tree, &tree->small, &tree->small_length,
+				&tree->small_allocated, path, st))
+			return -1;
+		offset = tree->small[tree->small_length - 1].path;
+	} else {
+		if (copy_add(tree, &tree->files, &tree->length,
+				&tree->allocated, path, st))
+			return -1;
+		offset = tree->files[tree->length - 1].path;
+	}
+	return st->st_nlink > 1 ? copy_remember(tree, st, offset) : 0;
+}
+
+static void copy_error(struct tree *tree, int error) {
+	if (!tree->error) tree->error = error;
+}
+
+/* path of the copy of a node relative to dstdir */
+static int copy_destination(struct tree *tree, const char *path,
+				char *out, size_t length) {
+	return snprintf(out, length, "%s%s", tree->name, path) >= (int)length;
+}
+
+static int copy_source(struct tree *tree, const char *path,
+			char *out, size_t length) {
+	return snprintf(out, length, "%s%s", tree->src, path) >= (int)length;
+}
+
+/* Walk the source to create the directories and the symbolic links, the
+ * files are only listed. The copy itself is skipped if it is inside the
+ * source. */
+static int copy_skeleton(struct tree *tree) {
+
+	char *paths[2], dst[PATH_MAX];
+	struct stat root;
+	size_t offset;
+	FTS *fts;
+	FTSENT *ent;
+	int ret;
+
+	paths[0] = (char*)tree->src;
+	paths[1] = NULL;
+	fts = fts_open(paths, FTS_PHYSICAL | FTS_COMFOLLOW | FTS_NOCHDIR, NULL);
+	if (!fts) return -1;
+
+	ret = 0;
+	offset = strlen(tree->src);
+	memset(&root, 0, sizeof(root));
+	while ((ent = fts_read(fts))) {
+		const char *path = ent->fts_path + offset;
+		if (copy_wait(tree->copy)) {
+			ret = -1;
+			goto end;
+		}
+		if (copy_destination(tree, path, V(dst))) {
+			copy_error(tree, ENAMETOOLONG);
+			if (ent->fts_info == FTS_D) fts_set(fts, ent, FTS_SKIP);
+			continue;
+		}
+		switch (ent->fts_info) {
+		case FTS_D:
+			if (ent->fts_level &&
+				ent->fts_statp->st_dev == root.st_dev &&
+				ent->fts_statp->st_ino == root.st_ino) {
+				fts_set(fts, ent, FTS_SKIP);
+				break;
+			}
+			/* writable until its content is copied */
+			if ((mkdirat(tree->dstdir, dst, S_IRWXU) &&
+				(errno != EEXIST || !tree->resumed)) ||
+				copy_add(tree, &tree->dirs, &tree->dirs_length,
+					&tree->dirs_allocated, path,
+					ent->fts_statp)) {
+				if (!ent->fts_level) {
+					ret = -1;
+					goto end;
+				}
+				copy_error(tree, errno);
+				fts_set(fts, ent, FTS_SKIP);
+				break;
+			}
+			if (!ent->fts_level) fstatat(tree->dstdir, dst, &root, 0);
+			copy_dir(tree->copy);
+			break;
+		case FTS_F:
+			if (copy_list(tree, path, dst, ent->fts_statp)) {
+				ret = -1;
+				goto end;
+			}
+			break;
+		case FTS_SL:
+		case FTS_SLNONE:
+		{
+			char target[PATH_MAX];
+			ssize_t length;
+			length = readlink(ent->fts_path, target,
+						sizeof(target) - 1);
+			if (length < 0) {
+				copy_error(tree, errno);
+				break;
+			}
+			target[length] = '\0';
+			if (symlinkat(target, tree->dstdir, dst) &&
+					(errno != EEXIST || !tree->resumed))
+				copy_error(tree, errno);
+			break;
+		}
+		case FTS_DEFAULT: /* fifos, sockets and devices */
+			if ((mknodat(tree->dstdir, dst, ent->fts_statp->st_mode,
+					ent->fts_statp->st_rdev) &&
+				(errno != EEXIST || !tree->resumed)) ||
+				fchmodat(tree->dstdir, dst,
+					ent->fts_statp->st_mode & 07777, 0))
+				copy_error(tree, errno);
+			break;
+		case FTS_DNR:
+		case FTS_ERR:
+		case FTS_NS:
+			copy_error(tree, ent->fts_errno);
+			break;
+		}
+	}
+	if (errno) ret = -1;
+end:
+	fts_close(fts);
+	return ret;
+}
+
+static void copy_failed(struct tree *tree, int error) {
+	pthread_mutex_lock(&tree->lock);
+	copy_error(tree, error);
+	pthread_mutex_unlock(&tree->lock);
+}
+
+/* Copy a file of the tree with the usual system calls. The partial copy
+ * of a large file is kept if it was interrupted, to be resumed. */
+static void copy_node(struct tree *tree, struct node *node) {
+
+	char src[PATH_MAX], dst[PATH_MAX], partial[PATH_MAX];
+	int srcfd, dstfd, ret;
+
+	errno = ENAMETOOLONG;
+	if (copy_source(tree, &tree->paths.data[node->path], V(src)) ||
+		copy_destination(tree, &tree->paths.data[node->path], V(dst)) ||
+		copy_partial(dst, V(partial)))
+		goto fail;
+	srcfd = open(src, O_RDONLY);
+	if (srcfd < 0) goto fail;
+	dstfd = openat(tree->dstdir, partial, O_WRONLY|O_CREAT|
+			(journal_partial(tree->journal, dst) ? 0 : O_TRUNC),
+			S_IRUSR | S_IWUSR);
+	if (dstfd < 0 || fchmod(dstfd, node->mode & 07777)) {
+		if (dstfd > -1) close(dstfd);
+		close(srcfd);
+		goto fail;
+	}
+	ret = file_copy(srcfd, dstfd, tree->copy, dst);
+	if (ret < 0) {
+		int error = errno;
+		if (error != ECANCELED || !copy_interrupted(tree->copy))
+			unlinkat(tree->dstdir, partial, 0);
+		errno = error;
+		goto fail;
+	}
+	if (copy_rename(tree->dstdir, partial, dst)) goto fail;
+	journal_file(tree->journal, dst);
+	copy_done(tree->copy, ret);
+	return;
+fail:
+	copy_failed(tree, errno);
+}
+
+/* the large files first, the small ones are left to the ring */
+static struct node *copy_next(struct tree *tree) {
+	struct node *node = NULL;
+	pthread_mutex_lock(&tree->lock);
+	if (tree->cancelled)
+		node = NULL;
+	else if (tree->next < tree->length)
+		node = &tree->files[tree->next++];
+	else if (tree->small_next < tree->small_length)
+		node = &tree->small[tree->small_next++];
+	pthread_mutex_unlock(&tree->lock);
+	return node;
+}
+
+static void *copy_worker(void *arg) {
+
+	struct tree *tree = arg;
+	struct node *node;
+
+	while ((node = copy_next(tree))) {
+		if (copy_wait(tree->copy)) {
+			pthread_mutex_lock(&tree->lock);
+			copy_error(tree, errno);
+			tree->cancelled = 1;
+			pthread_mutex_unlock(&tree->lock);
+			break;
+		}
+		copy_node(tree, node);
+	}
+	return NULL;
+}
+
+#ifdef HAS_IO_URING
+/* small file in the ring */
+struct pending {
+	struct node *node;
+	char src[PATH_MAX];
+	char dst[PATH_MAX];
+	char partial[PATH_MAX];
+	int srcfd;
+	int dstfd;
+	int error;
+	off_t size; /* of the opened source, it may have changed since the walk */
+	int strategy;
+};
+
+/* Submit the queued entries and store their results by user_data. If the
+ * ring fails the requests already submitted are still waited for, the
+ * results of the others are left unchanged. */
+static int copy_reap(struct ring *ring, unsigned int count, int *results) {
+	unsigned int submit = count, reaped = 0;
+	int failed = 0;
+	while (reaped < count - submit || (!failed && submit)) {
+		struct io_uring_cqe *cqe = ring_peek(ring);
+		long ret;
+		if (cqe) {
+			results[cqe->user_data] = cqe->res;
+			ring_seen(ring);
+			reaped++;
+			continue;
+		}
+		if (failed) {
+			if (ring_enter(ring, 0, count - submit - reaped) < 0)
+				return -1;
+			continue;
+		}
+		ret = ring_enter(ring, submit, count - reaped);
+		if (ret < 0) failed = 1;
+		else submit -= ret;
+	}
+	return failed ? -1 : 0;
+}
+
+static void copy_open(struct ring *ring, int dir, const char *path,
+			int flags, mode_t mode, unsigned long data) {
+	struct io_uring_sqe *sqe = ring_queue(ring);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = dir;
+	sqe->addr = (unsigned long)path;
+	sqe->open_flags = flags;
+	sqe->len = mode;
+	sqe->user_data = data;
+}
+
+/* close the files of a batch and remove the copies it created */
+static void copy_unbatch(struct tree *tree, struct pending *files,
+			size_t count) {
+	size_t i;
+	for (i = 0; i < count; i++) {
+		struct pending *file = &files[i];
+		if (file->srcfd > -1) close(file->srcfd);
+		if (file->dstfd > -1) {
+			close(file->dstfd);
+			unlinkat(tree->dstdir, file->partial, 0);
+		}
+		file->srcfd = file->dstfd = -1;
+	}
+}
+
+/* Copy a batch of small files with few system calls: the files are all
+ * opened, then read and written and then closed and renamed, each step
+ * being a single submission to the ring. Like the other copies they have
+ * a temporary name until they are complete, the copies of the files that
+ * failed are removed. Returns -1 if the ring can't open files or fails
+ * before the files are written, nothing of the batch is left and it can
+ * be copied with the usual system calls. */
+static int copy_batch(struct tree *tree, struct ring *ring,
+			struct pending *files, size_t count, char *buf,
+			int fixed) {
+
+	int results[RING_FILES * 3]; /* source, copy and rename of each file */
+	const char *copied[RING_FILES];
+	unsigned int queued, i;
+	size_t bytes, length;
+	int old;
+
+	queued = 0;
+	for (i = 0; i < count; i++) {
+		struct pending *file = &files[i];
+		const char *path = &tree->paths.data[file->node->path];
+		file->srcfd = file->dstfd = -1;
+		file->error = 0;
+		file->size = 0;
+		file->strategy = COPY_RING;
+		if (copy_source(tree, path, V(file->src)) ||
+			copy_destination(tree, path, V(file->dst)) ||
+			copy_partial(file->dst, V(file->partial))) {
+			file->error = ENAMETOOLONG;
+			continue;
+		}
+		copy_open(ring, AT_FDCWD, file->src, O_RDONLY, 0, i * 3);
+		copy_open(ring, tree->dstdir, file->partial,
+				O_WRONLY|O_CREAT|O_TRUNC,
+				file->node->mode & 07777, i * 3 + 1);
+		queued += 2;
+	}
+	for (i = 0; i < count * 3; i++) results[i] = RING_PENDING;
+	old = copy_reap(ring, queued, results) ? -1 : 1;
+	for (i = 0; i < count; i++) {
+		struct pending *file = &files[i];
+		int in = results[i * 3], out = results[i * 3 + 1];
+		if (file->error) continue;
+		file->srcfd = in < 0 ? -1 : in;
+		file->dstfd = out < 0 ? -1 : out;
+		if (in < 0 || out < 0) file->error = in < 0 ? -in : -out;
+		if (old > 0 && (in != -EINVAL || out != -EINVAL)) old = 0;
+	}
+	/* the ring failed or the kernel is older than its open requests */
+	if (old) {
+		copy_unbatch(tree, files, count);
+		return -1;
+	}
+
+	queued = 0;
+	for (i = 0; i < count; i++) {
+		struct pending *file = &files[i];
+		struct io_uring_sqe *sqe;
+		struct stat st;
+		if (file->error) continue;
+		/* the mode was restricted by the umask */
+		if ((file->node->mode & 07777 & tree->umask) &&
+				fchmod(file->dstfd, file->node->mode & 07777)) {
+			file->error = errno;
+			continue;
+		}
+		if (fstat(file->srcfd, &st)) {
+			file->error = errno;
+			continue;
+		}
+		/* it may have changed since the walk */
+		file->size = st.st_size;
+		if (!file->size || file->size > SMALL_FILE) continue;
+		sqe = ring_queue(ring);
+		sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+		sqe->fd = file->srcfd;
+		sqe->addr = (unsigned long)&buf[i * SMALL_FILE];
+		sqe->len = file->size;
+		sqe->flags = IOSQE_IO_LINK; /* written once read */
+		sqe->user_data = i * 3;
+		sqe = ring_queue(ring);
+		sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+		sqe->fd = file->dstfd;
+		sqe->addr = (unsigned long)&buf[i * SMALL_FILE];
+		sqe->len = file->size;
+		sqe->user_data = i * 3 + 1;
+		queued += 2;
+	}
+	for (i = 0; i < count * 3; i++) results[i] = RING_PENDING;
+	if (copy_reap(ring, queued, results)) {
+		copy_unbatch(tree, files, count);
+		return -1;
+	}
+
+	queued = 0;
+	for (i = 0; i < count; i++) {
+		struct pending *file = &files[i];
+		struct io_uring_sqe *sqe;
+		/* it grew past its slice of the buffer */
+		if (!file->error && file->size > SMALL_FILE) {
+			struct stat st;
+			if (fstat(file->srcfd, &st) ||
+				(file->strategy = copy_file(file->srcfd,
+					file->dstfd, &st, tree->copy, NULL)) < 0)
+				file->error = errno;
+		} else if (!file->error && file->size) {
+			int in = results[i * 3], written = results[i * 3 + 1];
+			/* a short read cancels the write, the file shrunk */
+			if (in != file->size)
+				file->error = in < 0 ? -in : EIO;
+			else if (written != file->size)
+				file->error = written < 0 ? -written : EIO;
+		}
+		if (file->srcfd > -1) {
+			sqe = ring_queue(ring);
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->fd = file->srcfd;
+			sqe->user_data = i * 3;
+			queued++;
+		}
+		if (file->dstfd > -1) {
+			sqe = ring_queue(ring);
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->fd = file->dstfd;
+			sqe->user_data = i * 3 + 1;
+			queued++;
+#ifdef HAS_RING_RENAME
+			if (file->error) continue;
+			sqe->flags = IOSQE_IO_LINK; /* renamed once closed */
+			sqe = ring_queue(ring);
+			sqe->opcode = IORING_OP_RENAMEAT;
+			sqe->fd = tree->dstdir;
+			sqe->addr = (unsigned long)file->partial;
+			sqe->len = tree->dstdir;
+			sqe->addr2 = (unsigned long)file->dst;
+			sqe->rename_flags = RENAME_NOREPLACE;
+			sqe->user_data = i * 3 + 2;
+			queued++;
+#endif
+		}
+	}
+	for (i = 0; i < count * 3; i++) results[i] = RING_PENDING;
+	copy_reap(ring, queued, results);
+
+	bytes = length = 0;
+	for (i = 0; i < count; i++) {
+		struct pending *file = &files[i];
+		int closed = results[i * 3 + 1], renamed = results[i * 3 + 2];
+		/* the closes the ring could not do */
+		if (file->srcfd > -1 && results[i * 3] == RING_PENDING)
+			close(file->srcfd);
+		if (file->dstfd > -1 && closed == RING_PENDING)
+			closed = close(file->dstfd) ? -errno : 0;
+		if (!file->error && closed < 0) file->error = -closed;
+		/* renamed here if the kernel is older than the renames of
+		 * the ring or if the ring failed */
+		if (!file->error && renamed < 0 && renamed != -EINVAL &&
+				renamed != RING_PENDING)
+			file->error = -renamed;
+		else if (!file->error && renamed &&
+				copy_rename(tree->dstdir, file->partial,
+					file->dst))
+			file->error = errno;
+		if (file->error) {
+			if (file->dstfd > -1 && renamed)
+				unlinkat(tree->dstdir, file->partial, 0);
+			copy_failed(tree, file->error);
+			continue;
+		}
+		/* copy_file counted the bytes of the files it copied */
+		if (file->strategy == COPY_RING) bytes += file->size;
+		copied[length++] = file->dst;
+		copy_done(tree->copy, file->strategy);
+	}
+	journal_files(tree->journal, copied, length);
+	copy_bytes(tree->copy, bytes, bytes);
+	return 0;
+}
+
+/* Copy the small files of the tree by batches through an io_uring, from a
+ * registered buffer if the locked memory limit allows it. */
+static void copy_ring(struct tree *tree) {
+
+	struct ring ring;
+	struct pending *files;
+	char *buf;
+	int fixed;
+
+	memset(&ring, 0, sizeof(ring));
+	if (ring_init(&ring, RING_FILES * 2)) return;
+	files = malloc(RING_FILES * sizeof(struct pending));
+	buf = malloc(RING_FILES * SMALL_FILE);
+	if (!files || !buf) goto end;
+	fixed = !ring_buffers(&ring, buf, RING_FILES * SMALL_FILE);
+
+	for (;;) {
+		size_t i, count, start;
+
+		pthread_mutex_lock(&tree->lock);
+		start = tree->small_next;
+		count = tree->small_length - start;
+		if (count > RING_FILES) count = RING_FILES;
+		if (tree->cancelled) count = 0;
+		tree->small_next += count;
+		pthread_mutex_unlock(&tree->lock);
+		if (!count) break;
+
+		if (copy_wait(tree->copy)) {
+			pthread_mutex_lock(&tree->lock);
+			copy_error(tree, errno);
+			tree->cancelled = 1;
+			pthread_mutex_unlock(&tree->lock);
+			break;
+		}
+		for (i = 0; i < count; i++)
+			files[i].node = &tree->small[start + i];
+		if (!copy_batch(tree, &ring, files, count, buf, fixed))
+			continue;
+		for (i = 0; i < count; i++)
+			copy_node(tree, files[i].node);
+		break;
+	}
+end:
+	ring_close(&ring);
+	free(files);
+	free(buf);
+}
+#endif
+
+/* Link the files whose inode was already met to the copy of its first
+ * link, or copy them if the file system can't link them. */
+static void copy_links(struct tree *tree) {
+
+	size_t i;
+
+	for (i = 0; i < tree->links_length && !tree->cancelled; i++) {
+		char target[PATH_MAX], dst[PATH_MAX];
+		struct link *link = &tree->links[i];
+		if (copy_wait(tree->copy)) {
+			copy_error(tree, errno);
+			break;
+		}
+		if (copy_destination(tree, &tree->paths.data[link->target],
+					V(target)) ||
+			copy_destination(tree,
+				&tree->paths.data[link->node.path], V(dst))) {
+			copy_error(tree, ENAMETOOLONG);
+			continue;
+		}
+		if (!linkat(tree->dstdir, target, tree->dstdir, dst, 0) ||
+				(errno == EEXIST && tree->resumed))
+			copy_linked(tree->copy, link->node.size);
+		else if (errno == EPERM || errno == EMLINK ||
+				errno == EOPNOTSUPP)
+			copy_node(tree, &link->node);
+		else
+			copy_error(tree, errno);
+	}
+}
+
+/* Copy the directory at path as name in dstdir, the counts of what was
+ * copied are added to copy. Returns -1 with errno set to the first error
+ * if anything could not be copied. */
+int copy_tree(const char *path, int dstdir, const char *name,
+		struct copy *copy) {
+
+	pthread_t threads[COPY_THREADS_MAX];
+	struct tree tree;
+	size_t i, started, count;
+	int ret;
+
+	memset(&tree, 0, sizeof(tree));
+	tree.src = path;
+	tree.dstdir = dstdir;
+	tree.name = name;
+	tree.copy = copy;
+	tree.journal = copy ? copy->journal : NULL;
+	tree.resumed = tree.journal && tree.journal->resumed;
+	if (pthread_mutex_init(&tree.lock, NULL)) return -1;
+
+	/* the ring creates the files with their final mode */
+	tree.umask = creation_mask;
+
+	ret = copy_skeleton(&tree);
+	if (ret) tree.error = errno;
+
+	count = config_number("MZ_COPY_THREADS", COPY_THREADS);
+	if (count > COPY_THREADS_MAX) count = COPY_THREADS_MAX;
+	if (count > tree.length + tree.small_length)
+		count = tree.length + tree.small_length;
+	for (started = 0; !ret && started + 1 < count; started++) {
+		if (pthread_create(&threads[started], NULL, copy_worker, &tree))
+			break;
+	}
+#ifdef HAS_IO_URING
+	if (!ret && tree.small_length >= RING_MIN &&
+			config_number("MZ_COPY_RING", 1))
+		copy_ring(&tree);
+#endif
+	if (!ret) copy_worker(&tree);
+	for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+	if (!ret) copy_links(&tree);
+
+	/* the deepest directories first since their parents may become
+	 * read-only */
+	for (i = tree.dirs_length; i > 0; i--) {
+		char dst[PATH_MAX];
+		struct node *node = &tree.dirs[i - 1];
+		if (copy_destination(&tree, &tree.paths.data[node->path],
+					V(dst)) ||
+				fchmodat(dstdir, dst, node->mode & 07777, 0))
+			copy_error(&tree, errno);
+	}
+
+	pthread_mutex_destroy(&tree.lock);
+	free(tree.files);
+	free(tree.small);
+	free(tree.dirs);
+	free(tree.inodes);
+	free(tree.buckets);
+	free(tree.links);
+	arena_free(&tree.paths);
+	if (!tree.error) return 0;
+	errno = tree.error;
+	return -1;
+}
+
+/* add the number of files under path and their size to the totals of
+ * copy */
+int copy_measure(const char *path, struct copy *copy) {
+
+	char *paths[2];
+	FTS *fts;
+	FTSENT *ent;
+	size_t total;
+	off_t size;
+	int ret;
+
+	paths[0] = (char*)path;
+	paths[1] = NULL;
+	fts = fts_open(paths, FTS_PHYSICAL | FTS_COMFOLLOW | FTS_NOCHDIR, NULL);
+	if (!fts) return -1;
+	total = size = 0;
+	ret = 0;
+	while ((ent = fts_read(fts))) {
+		if (copy_wait(copy)) {
+			ret = -1;
+			break;
+		}
+		if (ent->fts_info != FTS_F) continue;
+		total++;
+		size += ent->fts_statp->st_size;
+	}
+	fts_close(fts);
+
+	pthread_mutex_lock(&progress);
+	copy->total += total;
+	copy->size += size;
+	pthread_mutex_unlock(&progress);
+	return ret;
+}
+
+static size_t chunk_threads(void) {
+	long n = config_number("MZ_CHUNK_THREADS", CHUNK_THREADS);
+	if (n < 1) return 1;
+	return n > COPY_THREADS_MAX ? COPY_THREADS_MAX : n;
+}
+
+static off_t chunk_size(void) {
+	long n = config_number("MZ_CHUNK_SIZE", CHUNK_SIZE);
+	return (off_t)(n < 1 ? 1 : n) * 1024 * 1024;
+}
+
+static void buffer_free(void *ptr) {
+	struct buffer *buf = ptr;
+	free(buf->data);
+	free(buf);
+}
+
+static void buffer_key(void) {
+	buffers_keyed = !pthread_key_create(&buffers, buffer_free);
+}
+
+/* Aligned buffer of at least size bytes for the calling thread, reused by
+ * its next copies and freed when it exits. */
+static char *buffer_get(size_t size) {
+
+	struct buffer *buf;
+	void *data;
+
+	pthread_once(&buffers_once, buffer_key);
+	if (!buffers_keyed) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	buf = pthread_getspecific(buffers);
+	if (!buf) {
+		buf = calloc(1, sizeof(struct buffer));
+		if (!buf) return NULL;
+		if (pthread_setspecific(buffers, buf)) {
+			free(buf);
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+	if (buf->size >= size) return buf->data;
+	if (posix_memalign(&data, BUFFER_ALIGN, size)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	free(buf->data);
+	buf->data = data;
+	buf->size = size;
+	return data;
+}
+
+/* A multiple of the block size of the source around BUFFER_MIN, large
+ * blocks of network filesystems get a buffer of their size. */
+static size_t buffer_size(const struct stat *st) {
+	size_t block = st->st_blksize > BUFFER_ALIGN ?
+			st->st_blksize : BUFFER_ALIGN;
+	size_t size = (BUFFER_MIN + block - 1) / block * block;
+	if (size > BUFFER_MAX) size = BUFFER_MAX / block * block;
+	return size ? size : block;
+}
+
+/* Switch both descriptors to O_DIRECT once the copy is buffered, they are
+ * shared by the threads of the file. */
+static int chunk_direct(struct chunks *chunks) {
+	pthread_mutex_lock(&chunks->lock);
+#ifdef O_DIRECT
+	if (!chunks->directed) {
+		int src = fcntl(chunks->src, F_GETFL);
+		int dst = fcntl(chunks->dst, F_GETFL);
+		chunks->directed = -1;
+		if (src != -1 && dst != -1 &&
+			!fcntl(chunks->src, F_SETFL, src | O_DIRECT)) {
+			if (!fcntl(chunks->dst, F_SETFL, dst | O_DIRECT))
+				chunks->directed = 1;
+			else
+				fcntl(chunks->src, F_SETFL, src);
+		}
+	}
+#else
+	chunks->directed = -1;
+#endif
+	pthread_mutex_unlock(&chunks->lock);
+	return chunks->directed > 0;
+}
+
+/* Reserve the blocks of the destination from offset to its end, its size
+ * is set if they can't be. */
+static int chunk_allocate(struct chunks *chunks, off_t offset) {
+	int ret;
+	chunks->allocated = 1;
+#ifdef __linux__
+	/* unlike posix_fallocate it doesn't write the blocks when the
+	 * filesystem can't allocate them */
+	ret = fallocate(chunks->dst, 0, offset, chunks->length - offset);
+#else
+	ret = posix_fallocate(chunks->dst, offset,
+				chunks->length - offset) ? -1 : 0;
+#endif
+	if (ret) ret = ftruncate(chunks->dst, chunks->length);
+	return ret;
+}
+
+/* copy a region of the file with offsets, so that the threads can share
+ * the descriptors */
+static int chunk_region(struct chunks *chunks, off_t offset, off_t length) {
+
+	ssize_t i;
+	off_t end;
+	char *buf;
+	int direct;
+
+#ifndef NO_COPY_FILE_RANGE
+	if (!chunks->usebuf) {
+		off_t in = offset, out = offset;
+		while (length > 0) {
+			i = copy_file_range(chunks->src, &in, chunks->dst,
+						&out, length, 0);
+			if (i <= 0) break;
+			length -= i;
+		}
+		if (!length) return 0;
+		offset = in;
+	}
+#endif
+
+	/* Copy_file_range failed or can't be used. The blocks of a file copied
+	 * by a single thread are only reserved now for the loop, the
+	 * copies in the kernel allocate them as a whole. */
+	if (!chunks->allocated && !chunks->sparse &&
+			chunks->length >= BUFFER_MIN &&
+			chunk_allocate(chunks, offset))
+		return -1;
+	buf = buffer_get(chunks->buffer);
+	if (!buf) return -1;
+	end = offset + length;
+	direct = chunks->direct && chunk_direct(chunks);
+	if (direct) {
+		/* direct I/O only works on whole blocks, the end of the
+		 * copy is truncated once done */
+		offset -= offset % BUFFER_ALIGN;
+		length = end - offset;
+		length += (BUFFER_ALIGN - length % BUFFER_ALIGN) % BUFFER_ALIGN;
+	}
+	while (length > 0) {
+		ssize_t done, size;
+		size = length < (off_t)chunks->buffer ?
+			length : (off_t)chunks->buffer;
+		i = pread(chunks->src, buf, size, offset);
+		if (i <= 0) {
+			if (!i) errno = EIO; /* truncated during the copy */
+			return -1;
+		}
+		if (direct && i < size) {
+			/* the end of the file, written as a whole block */
+			if (offset + i < end) {
+				errno = EIO;
+				return -1;
+			}
+			memset(&buf[i], 0, size - i);
+			i = size;
+		}
+		for (done = 0; done < i; ) {
+			ssize_t n = pwrite(chunks->dst, buf + done, i - done,
+						offset + done);
+			if (n <= 0) return -1;
+			done += n;
+		}
+		offset += i;
+		length -= i;
+	}
+	pthread_mutex_lock(&chunks->lock);
+	chunks->strategy = COPY_BUFFER;
+	pthread_mutex_unlock(&chunks->lock);
+	return 0;
+}
+
+/* Copy a range of the file. Only its data regions are copied if the file
+ * is sparse, the holes are left in the destination. */
+static int chunk_copy(struct chunks *chunks, off_t offset, off_t length) {
+
+	off_t end, data, hole, transferred;
+
+	transferred = 0;
+	end = offset + length;
+	while (offset < end) {
+		data = offset;
+		hole = end;
+#ifdef SEEK_DATA
+		if (chunks->sparse) {
+			data = lseek(chunks->src, offset, SEEK_DATA);
+			if (data < 0 && errno == ENXIO) break; /* only holes */
+			if (data < 0) data = offset;
+			if (data >= end) break;
+			hole = lseek(chunks->src, data, SEEK_HOLE);
+			if (hole < 0 || hole > end) hole = end;
+		}
+#endif
+		if (chunk_region(chunks, data, hole - data)) return -1;
+		transferred += hole - data;
+		offset = hole;
+	}
+	copy_bytes(chunks->copy, length, transferred);
+	return 0;
+}
+
+/* Drop a copied range from the page cache. The pages of the destination
+ * can only be dropped once written back, which is started when the range
+ * is copied and waited for after the next one. */
+static void chunk_drop(struct chunks *chunks, off_t offset, off_t length,
+			int written) {
+#ifdef POSIX_FADV_DONTNEED
+	if (!written) {
+		posix_fadvise(chunks->src, offset, length, POSIX_FADV_DONTNEED);
+#ifdef SYNC_FILE_RANGE_WRITE
+		sync_file_range(chunks->dst, offset, length,
+				SYNC_FILE_RANGE_WRITE);
+#endif
+		return;
+	}
+#ifdef SYNC_FILE_RANGE_WRITE
+	sync_file_range(chunks->dst, offset, length,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+			SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+	posix_fadvise(chunks->dst, offset, length, POSIX_FADV_DONTNEED);
+#else
+	(void)chunks; (void)offset; (void)length; (void)written;
+#endif
+}
+
+static void *chunk_worker(void *arg) {
+
+	struct chunks *chunks = arg;
+	off_t last = -1, last_length = 0; /* range waiting to be dropped */
+
+	for (;;) {
+		off_t offset, length;
+		int stop;
+
+		pthread_mutex_lock(&chunks->lock);
+		offset = chunks->next;
+		chunks->next += chunks->size;
+		stop = chunks->error || offset >= chunks->length;
+		pthread_mutex_unlock(&chunks->lock);
+		if (stop) break;
+
+		length = chunks->length - offset;
+		if (length > chunks->size) length = chunks->size;
+		if (journal_copied(chunks->journal, chunks->path,
+					offset, length)) {
+			copy_bytes(chunks->copy, length, 0);
+			continue;
+		}
+		if (copy_wait(chunks->copy) ||
+				chunk_copy(chunks, offset, length)) {
+			pthread_mutex_lock(&chunks->lock);
+			if (!chunks->error) chunks->error = errno;
+			pthread_mutex_unlock(&chunks->lock);
+			break;
+		}
+		/* only recorded once on the disk to be resumed from there */
+		if (chunks->journal && !fdatasync(chunks->dst))
+			journal_range(chunks->journal, chunks->path,
+					offset, length);
+		if (!chunks->bypass) continue;
+		chunk_drop(chunks, offset, length, 0);
+		if (last >= 0) chunk_drop(chunks, last, last_length, 1);
+		last = offset;
+		last_length = length;
+	}
+	if (last >= 0) chunk_drop(chunks, last, last_length, 1);
+	return NULL;
+}
+
+/* Copy the st_size bytes of src to dst, st being the status of src. The
+ * data regions of sparse files are the only ones copied. Files of at least
+ * two ranges are copied by several threads after allocating the
+ * destination, the others before the read and write loop if copy_file_range
+ * can't be used. Large copies are dropped from the page
+ * cache and the read and write loop uses O_DIRECT for files of at least
+ * MZ_DIRECT megabytes. The bytes are added to the progress of copy if not
+ * NULL, the ranges of large files are recorded in its journal under path.
+ * Returns the strategy used or -1 on error. */
+int copy_file(int src, int dst, const struct stat *st, struct copy *copy,
+		const char *path) {
+
+	pthread_t threads[COPY_THREADS_MAX];
+	struct chunks chunks;
+	size_t i, started, count;
+	long direct;
+	int ret;
+
+	memset(&chunks, 0, sizeof(chunks));
+	chunks.src = src;
+	chunks.dst = dst;
+	chunks.length = st->st_size;
+	chunks.size = chunk_size();
+	chunks.sparse = (off_t)st->st_blocks * 512 < chunks.length;
+	chunks.buffer = buffer_size(st);
+	chunks.bypass = chunks.length >= CACHE_BYPASS;
+	direct = config_number("MZ_DIRECT", 0);
+	chunks.direct = !chunks.sparse && direct > 0 &&
+			chunks.length >= (off_t)direct * 1024 * 1024;
+	chunks.copy = copy;
+#ifndef NO_COPY_FILE_RANGE
+	chunks.strategy = COPY_RANGE;
+#else
+	chunks.strategy = COPY_BUFFER;
+	chunks.usebuf = 1;
+#endif
+	if (pthread_mutex_init(&chunks.lock, NULL)) return -1;
+
+	count = chunks.length < 2 * chunks.size ? 1 : chunk_threads();
+	if ((off_t)count > chunks.length / chunks.size + 1)
+		count = chunks.length / chunks.size + 1;
+	if (copy && path && chunks.length >= 2 * chunks.size) {
+		chunks.journal = copy->journal;
+		chunks.path = path;
+	}
+
+	/* the destination gets its final size first, the skipped holes stay
+	 * holes, otherwise its blocks are reserved at once */
+	ret = 0;
+	if (chunks.sparse) {
+		ret = ftruncate(dst, chunks.length);
+	} else if (count > 1) {
+		ret = chunk_allocate(&chunks, 0);
+	}
+	if (ret) {
+		pthread_mutex_destroy(&chunks.lock);
+		return -1;
+	}
+#ifdef POSIX_FADV_SEQUENTIAL
+	if (chunks.length > BUFFER_MIN)
+		posix_fadvise(src, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	for (started = 0; started + 1 < count; started++) {
+		if (pthread_create(&threads[started], NULL, chunk_worker,
+					&chunks))
+			break;
+	}
+	chunk_worker(&chunks);
+	for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+	/* the last block was written whole */
+	if (!chunks.error && chunks.directed > 0 &&
+			ftruncate(dst, chunks.length))
+		chunks.error = errno;
+
+	pthread_mutex_destroy(&chunks.lock);
+	if (!chunks.error) return chunks.strategy;
+	errno = chunks.error;
+	return -1;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Recursive copy of a directory. The directories are created first while
+ * walking the source, then the files are copied by a pool of threads and
+ * the files sharing an inode are linked to the copy of the first one. On
+ * Linux the small files are copied in batches through an io_uring unless
+ * MZ_COPY_RING is 0. The size of what would be copied can be measured
+ * first. */
+int copy_tree(const char *path, int dstdir, const char *name,
+		struct copy *copy);
+int copy_measure(const char *path, struct copy *copy);
+
+/* Must be called by the main thread before any copy. */
+void copy_init(void);
+
+/* Copy of the content of a file. Large files are copied by ranges, each
+ * one by a different thread, the size of the ranges and the number of
+ * threads can be set with MZ_CHUNK_SIZE (in megabytes) and
+ * MZ_CHUNK_THREADS. Without copy_file_range, files of at least MZ_DIRECT
+ * megabytes are copied with O_DIRECT, never by default. */
+int copy_file(int src, int dst, const struct stat *st, struct copy *copy,
+		const char *path);
+
+/* Files are copied under a temporary name until they are complete, they
+ * never replace a file when they are renamed. */
+int copy_partial(const char *path, char *out, size_t length);
+int copy_rename(int dir, const char *partial, const char *path);
+
+/* Progress of a copy, shared between the threads copying and the main
+ * thread which can pause or cancel it. A copy cancelled by quitting keeps
+ * its partial files to be resumed, they are removed otherwise. */
+#define COPY_INTERRUPTED 2 /* cancelled by quitting */
+void copy_bytes(struct copy *copy, size_t bytes, size_t transferred);
+void copy_done(struct copy *copy, int strategy);
+void copy_resumed(struct copy *copy, size_t bytes);
+void copy_linked(struct copy *copy, size_t bytes);
+void copy_removed(struct copy *copy, size_t files, size_t bytes);
+void copy_dir(struct copy *copy);
+int copy_wait(struct copy *copy);
+void copy_control(struct copy *copy, int paused, int cancelled);
+int copy_cancelled(struct copy *copy);
+int copy_interrupted(struct copy *copy);
+void copy_read(struct copy *copy, struct copy *out);
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "util.h"
+#include "dir.h"
+
+#if defined(__linux__) && defined(SYS_getdents64)
+#define HAS_GETDENTS
+#define DENTS_BUFFER (256 * 1024)
+
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+#endif
+
+struct dir {
+	int fd;
+	DIR *dp;
+#ifdef HAS_GETDENTS
+	char *buf;
+	size_t length;
+	size_t pos;
+#endif
+};
+
+struct dir *dir_open(int fd) {
+
+	struct dir *dir;
+
+	dir = malloc(sizeof(struct dir));
+	if (!dir) return NULL;
+	PZERO(dir);
+
+	/* open a new description to not share the offset with fd */
+	dir->fd = openat(fd, ".", O_RDONLY|O_DIRECTORY);
+	if (dir->fd < 0) {
+		free(dir);
+		return NULL;
+	}
+
+#ifdef HAS_GETDENTS
+	dir->buf = malloc(DENTS_BUFFER);
+	if (dir->buf) return dir;
+#endif
+
+	dir->dp = fdopendir(dir->fd);
+	if (!dir->dp) {
+		close(dir->fd);
+		free(dir);
+		return NULL;
+	}
+	return dir;
+}
+
+static int dir_readdir(struct dir *dir, const char **name, int *type) {
+
+	struct dirent *entry;
+
+	errno = 0;
+	entry = readdir(dir->dp);
+	if (!entry) return errno ? -1 : 0;
+	*name = entry->d_name;
+#ifdef sun
+	*type = DT_UNKNOWN;
+#else
+	*type = entry->d_type;
+#endif
+	return 1;
+}
+
+/* return 1 and set name and type to the next entry, 0 at the end of the
+ * directory and -1 on error, the name is valid until the next call */
+int dir_read(struct dir *dir, const char **name, int *type) {
+#ifdef HAS_GETDENTS
+	struct linux_dirent64 *entry;
+
+	if (dir->dp) return dir_readdir(dir, name, type);
+
+	if (dir->pos >= dir->length) {
+		long len = syscall(SYS_getdents64, dir->fd,
+				dir->buf, DENTS_BUFFER);
+		if (len < 0 && errno == ENOSYS) {
+			/* fallback to readdir */
+			free(dir->buf);
+			dir->buf = NULL;
+			dir->dp = fdopendir(dir->fd);
+			if (!dir->dp) return -1;
+			return dir_readdir(dir, name, type);
+		}
+		if (len <= 0) return len ? -1 : 0;
+		dir->length = len;
+		dir->pos = 0;
+	}
+
+	entry = (struct linux_dirent64*)&dir->buf[dir->pos];
+	dir->pos += entry->d_reclen;
+	*name = entry->d_name;
+	*type = entry->d_type;
+	return 1;
+#else
+	return dir_readdir(dir, name, type);
+#endif
+}
+
+void dir_close(struct dir *dir) {
+	if (!dir) return;
+	if (dir->dp) closedir(dir->dp);
+	else close(dir->fd);
+#ifdef HAS_GETDENTS
+	free(dir->buf);
+#endif
+	free(dir);
+}
@@ -28,17 +28,30 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <fts.h>
+#include <fnmatch.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 #include "termbox.h"
+#include "arena.h"
 #include "view.h"
 #include "file.h"
 #include "strlcpy.h"
 #include "client.h"
 #include "util.h"
-#include "spawn.h"
 #include "trash.h"
+#include "dir.h"
+#include "clock.h"
+#include "sort.h"
+#include "cache.h"
+#include "meta.h"
+#include "copy.h"
+#include "purge.h"
+#include "journal.h"
 
 int file_init(struct view *view, const char* path) {
 
@@ -67,6 +80,8 @@ int file_cd_abs(struct view *view, const char *path) {
 	close(view->fd);
 	view->fd = fd;
 	STRCPY(view->path, path);
+	cache_put(view);
+	file_free(view);
 	view->selected = 0;
 	return 0;
 }
@@ -106,47 +121,75 @@ int file_cd(struct view *view, const char *path) {
 }
 
 void file_free(struct view *view) {
-	size_t i;
-	for (i = 0; i < view->length; i++) {
-		free(view->entries[i].other);
-		view->entries[i].other = NULL;
-	}
+	dir_close(view->loading);
+	view->loading = NULL;
+	free(view->pending);
+	view->pending = NULL;
 	free(view->entries);
-	view->length = 0;
+	free(view->index);
+	arena_free(&view->names);
+	view->length = view->allocated = view->count = 0;
+	view->unresolved = view->resolving = 0;
 	view->entries = NULL;
+	view->index = NULL;
+	PZERO(&view->stamp);
 }
 
-int file_sort(const void* a, const void* b)
-{
-	struct entry *first = (struct entry*)a;
-	struct entry *second = (struct entry*)b;
-	int i = 0, j = 0;
-
-	if (first->type != second->type) {
-		if (first->type == DT_DIR) return -1;
-		if (second->type == DT_DIR) return 1;
-	}
-	while (1) {
-		uint32_t c1, c2;
-		do {
-			if (!first->name[i]) return 0;
-			i += tb_utf8_char_to_unicode(&c1, &first->name[i]);
-		} while (c1 == ' ' || c1 == '\t');
-		do {
-			if (!second->name[j]) return 0;
-			j += tb_utf8_char_to_unicode(&c2, &second->name[j]);
-		} while (c2 == ' ' || c2 == '\t');
-		c1 = tolower(c1);
-		c2 = tolower(c2);
-		if (c1 != c2)
-			return c1 < c2 ? -1 : 1;
+static int file_visible(struct view *view, struct entry *entry) {
+	const char *name = NAME(view, *entry);
+	if (!view->showhidden && name[0] == '.') return 0;
+	if (view->showtype && view->showtype != (entry->type == DT_DIR ?
+				FILTER_DIRS : FILTER_FILES))
+		return 0;
+	if (*view->filter && fnmatch(view->filter, name, 0)) return 0;
+	return 1;
+}
+
+/* Rebuild the index of the entries passing the filters. The cursor is
+ * placed on the entry at position pos in the listing, or on the next one
+ * passing the filters if it was filtered out. The cursor doesn't move if
+ * pos is FILE_NOPOS. */
+int file_filter(struct view *view, size_t pos) {
+
+	size_t i, j, selected;
+	void *ptr;
+
+	ptr = realloc(view->index, AZ(view->length) * sizeof(size_t));
+	if (!ptr) return -1;
+	view->index = ptr;
+
+	selected = view->selected;
+	view->selected = 0;
+	for (i = j = 0; i < view->length; i++) {
+		if (!file_visible(view, &view->entries[i])) continue;
+		if (i <= pos) view->selected = j;
+		if (i < pos) view->selected++;
+		view->index[j++] = i;
 	}
+	view->count = j;
+	if (pos == FILE_NOPOS) view->selected = selected;
+	if (view->selected >= view->count)
+		view->selected = view->count ? view->count - 1 : 0;
 	return 0;
 }
 
+/* position in the listing of the entry under the cursor */
+size_t file_position(struct view *view) {
+	return EMPTY(view) ? 0 : view->index[view->selected];
+}
+
+/* position in the listing of the entry whose name is at offset id */
+static size_t file_locate(struct view *view, size_t id) {
+	size_t i;
+	for (i = 0; id != ARENA_ERR && i < view->length; i++) {
+		if (view->entries[i].name == id) return i;
+	}
+	return FILE_NOPOS;
+}
+
 int file_reload(struct view *view) {
 	if (view->fd == TRASH_FD) {
-		return trash_view(view);
+		return trash_reload(view);
 	}
 	close(view->fd);
 	view->fd = open(view->path, O_DIRECTORY);
@@ -154,127 +197,404 @@ int file_reload(struct view *view) {
 	return file_ls(view);
 }
 
-int file_ls(struct view *view) {
-	struct dirent *entry;
-	DIR *dp;
-	int length, i, fd;
-
-	fd = dup(view->fd);
-	if (fd == -1) return -1;
-	dp = fdopendir(fd);
-	if (dp == NULL) {
-		close(fd);
-		return -1;
+#define ENTRIES_MIN 256
+#define LOAD_BATCH 1024 /* minimum number of entries read per batch */
+#define LOAD_SLICE 0.05 /* maximum time spent reading a batch in seconds */
+
+/* append an unsorted entry to the listing */
+static int file_add(struct view *view, const char *name, int type) {
+
+	struct entry *e;
+	int ret;
+
+	if (view->length >= view->allocated) {
+		size_t allocated;
+		void *ptr;
+		allocated = view->allocated ? view->allocated * 2 : ENTRIES_MIN;
+		ptr = realloc(view->entries, allocated * sizeof(struct entry));
+		if (!ptr) return -1;
+		view->entries = ptr;
+		view->allocated = allocated;
 	}
 
-	length = 0;
-	while ((entry = readdir(dp))) {
-		if (!view->showhidden && entry->d_name[0] == '.')
+	e = &view->entries[view->length];
+	e->selected = 0;
+	e->flags = 0;
+	e->other = 0;
+	e->length = strlen(name);
+	e->name = arena_add(&view->names, name, e->length);
+	if (e->name == ARENA_ERR) return -1;
+	ret = sort_key(&view->names, name, e->length);
+	if (ret < 0) return -1;
+	e->key_length = ret;
+	/* the type is resolved later, shown entries first */
+	if (type == DT_LNK || type == DT_UNKNOWN) {
+		e->type = DT_REG;
+		e->flags = ENTRY_UNRESOLVED;
+		view->unresolved++;
+	} else {
+		e->type = type;
+	}
+	view->length++;
+	return 0;
+}
+
+/* Read the next batch of the directory being listed and merge it into the
+ * sorted listing. Returns 1 if there are entries left to read, 0 once the
+ * listing is complete and -1 on error. */
+int file_load(struct view *view) {
+
+	const char *name;
+	size_t sorted, limit, id;
+	double start;
+	int type, ret;
+
+	if (!view->loading) return 0;
+
+	start = clock_monotonic();
+	sorted = view->length;
+	limit = sorted > LOAD_BATCH ? sorted : LOAD_BATCH;
+	/* a cursor left on the first entry stays at the top */
+	id = EMPTY(view) || !view->selected ? ARENA_ERR : SELECTED(view).name;
+	ret = 1;
+	while (view->length - sorted < limit) {
+		if (!((view->length - sorted + 1) % 64) &&
+				clock_elapsed(start) > LOAD_SLICE)
+			break;
+		ret = dir_read(view->loading, &name, &type);
+		if (ret <= 0) break;
+		if (name[0] == '.' && (!name[1] ||
+				(name[1] == '.' && !name[2])))
 			continue;
-		if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
-			length++;
+		if (file_add(view, name, type)) {
+			ret = -1;
+			break;
+		}
+		/* entry that was selected before reloading the listing */
+		if (view->pending && !strcmp(name, view->pending)) {
+			id = view->entries[view->length - 1].name;
+			free(view->pending);
+			view->pending = NULL;
+		}
 	}
-	if (length == 0) {
-		closedir(dp);
-		file_free(view);
-		return 0;
+
+	sort_merge(view->entries, sorted, view->length, &view->names);
+
+	/* keep the cursor on the same entry */
+	if (file_filter(view, file_locate(view, id))) ret = -1;
+
+	if (ret <= 0) {
+		dir_close(view->loading);
+		view->loading = NULL;
+		free(view->pending);
+		view->pending = NULL;
+		view->elapsed = clock_elapsed(view->started);
+		/* changes were made while reading the directory */
+		if (!ret && view->outdated) return file_reload(view);
 	}
-	
-	rewinddir(dp);
-	file_free(view);
-	view->entries = calloc(length, sizeof(struct entry));
-	if (!view->entries) {
-		closedir(dp);
-		return -1;
+	return ret;
+}
+
+/* Stat the entries at the given positions of the listing to know their
+ * type. Returns the number of entries that were not of the guessed type,
+ * they are flagged to be moved, or -1 on error. */
+static long file_stat(struct view *view, size_t *positions, size_t length) {
+
+	struct meta *metas;
+	size_t i;
+	long moved;
+
+	if (!length) return 0;
+	metas = malloc(length * sizeof(struct meta));
+	if (!metas) return -1;
+	for (i = 0; i < length; i++)
+		metas[i].name = NAME(view, view->entries[positions[i]]);
+	meta_stat(view->fd, metas, length, 0);
+
+	moved = 0;
+	for (i = 0; i < length; i++) {
+		struct entry *e = &view->entries[positions[i]];
+		int type = !metas[i].error && S_ISDIR(metas[i].st.st_mode) ?
+				DT_DIR : DT_REG;
+		e->flags &= ~ENTRY_UNRESOLVED;
+		view->unresolved--;
+		if (e->type == type) continue;
+		e->type = type;
+		e->flags |= ENTRY_MOVED;
+		moved++;
 	}
-	i = 0;
-	while ((entry = readdir(dp)) && i < length) {
-		if (!strcmp(entry->d_name, ".") ||
-				!strcmp(entry->d_name, ".."))
+	free(metas);
+	return moved;
+}
+
+/* Move the entries whose type changed to their place in the listing, moved
+ * is their number. The cursor stays on the same entry. */
+static int file_reorder(struct view *view, size_t moved) {
+
+	struct entry *tmp;
+	size_t i, j, k, id;
+
+	if (!moved) return 0;
+	tmp = malloc(moved * sizeof(struct entry));
+	if (!tmp) return -1;
+
+	id = EMPTY(view) ? ARENA_ERR : SELECTED(view).name;
+	for (i = j = k = 0; i < view->length; i++) {
+		struct entry *e = &view->entries[i];
+		if (e->flags & ENTRY_MOVED) {
+			e->flags &= ~ENTRY_MOVED;
+			tmp[k++] = *e;
 			continue;
-		if (!view->showhidden && entry->d_name[0] == '.')
+		}
+		view->entries[j++] = *e;
+	}
+	memcpy(&view->entries[j], tmp, k * sizeof(struct entry));
+	free(tmp);
+	sort_merge(view->entries, j, view->length, &view->names);
+	return file_filter(view, file_locate(view, id));
+}
+
+/* resolve the type of the entries shown on the given rows of the view */
+int file_resolve(struct view *view, size_t first, size_t rows) {
+
+	size_t *positions, i, length;
+	long moved;
+
+	if (!view->unresolved || first >= view->count) return 0;
+	if (rows > view->count - first) rows = view->count - first;
+	positions = malloc(rows * sizeof(size_t));
+	if (!positions) return -1;
+	for (i = length = 0; i < rows; i++) {
+		if (ENTRY(view, first + i).flags & ENTRY_UNRESOLVED)
+			positions[length++] = view->index[first + i];
+	}
+	moved = file_stat(view, positions, length);
+	free(positions);
+	if (moved < 0) return -1;
+	return file_reorder(view, moved);
+}
+
+#define RESOLVE_MIN 256
+#define RESOLVE_MAX 65536
+
+/* Resolve the type of the next batch of entries once the listing is fully
+ * read. The size of the batches adapts to the speed of the filesystem to
+ * take about LOAD_SLICE. Returns 1 if there are entries left to resolve,
+ * 0 once every type is known and -1 on error.
+ *
+ * Resolved directories are only moved before the position where the
+ * resolution continues, so the entries after it keep their position. */
+int file_resolve_next(struct view *view) {
+
+	static size_t batch = RESOLVE_MIN;
+	size_t *positions, i, length, max;
+	double start, elapsed;
+	long moved;
+
+	if (view->loading || !view->unresolved) return 0;
+
+	max = view->unresolved < batch ? view->unresolved : batch;
+	positions = malloc(max * sizeof(size_t));
+	if (!positions) return -1;
+	for (i = view->resolving, length = 0;
+			i < view->length && length < max; i++) {
+		if (view->entries[i].flags & ENTRY_UNRESOLVED)
+			positions[length++] = i;
+	}
+	/* start again from the top if some entries were missed */
+	view->resolving = i < view->length ? i : 0;
+
+	start = clock_monotonic();
+	moved = file_stat(view, positions, length);
+	free(positions);
+	if (moved < 0 || file_reorder(view, moved)) return -1;
+	elapsed = clock_elapsed(start);
+	if (elapsed < LOAD_SLICE / 4 && batch < RESOLVE_MAX) batch *= 2;
+	else if (elapsed > LOAD_SLICE && batch > RESOLVE_MIN) batch /= 2;
+	return view->unresolved != 0;
+}
+
+/* position of an entry in the listing, the first sorted entries are
+ * searched by name and the unsorted ones after them one by one */
+static size_t file_find(struct view *view, size_t sorted, const char *name,
+			int dir) {
+	size_t i;
+	i = sort_find(view->entries, sorted, &view->names, name, dir);
+	if (i < sorted) return i;
+	i = sort_find(view->entries, sorted, &view->names, name, !dir);
+	if (i < sorted) return i;
+	for (i = sorted; i < view->length; i++) {
+		if (!strcmp(NAME(view, view->entries[i]), name)) return i;
+	}
+	return FILE_NOPOS;
+}
+
+#define ARENA_COMPACT (1024 * 1024)
+
+/* copy the names and keys of the entries to a new arena */
+static int file_compact(struct view *view) {
+
+	struct arena names;
+	size_t i;
+
+	PZERO(&names);
+	for (i = 0; i < view->length; i++) {
+		struct entry *e = &view->entries[i];
+		size_t size = e->length + e->key_length + 2;
+		char *ptr = arena_reserve(&names, size);
+		if (!ptr) {
+			arena_free(&names);
+			return -1;
+		}
+		memcpy(ptr, NAME(view, *e), size);
+		e->name = names.length;
+		names.length += size;
+	}
+	arena_free(&view->names);
+	view->names = names;
+	return 0;
+}
+
+/* Apply the changes made to the directory since it was listed without
+ * reading it again. The created entries are merged into the listing and
+ * the removed ones are dropped, the cursor stays on the same entry. */
+int file_update(struct view *view, struct change *changes, size_t length) {
+
+	struct stat st;
+	size_t sorted, kept, live, i, j, id;
+	int ret;
+
+	/* the directory is listed again once it is fully read */
+	if (view->loading) {
+		view->outdated = 1;
+		return 0;
+	}
+
+	ret = 0;
+	sorted = view->length;
+	for (i = 0; i < length; i++) {
+		size_t found;
+		found = file_find(view, sorted, changes[i].name, changes[i].dir);
+		if (!changes[i].created) {
+			if (found != FILE_NOPOS)
+				view->entries[found].flags |= ENTRY_REMOVED;
+			continue;
+		}
+		if (found != FILE_NOPOS) {
+			view->entries[found].flags &= ~ENTRY_REMOVED;
 			continue;
-		view->entries[i].selected = 0;
-		strlcpy(view->entries[i].name, entry->d_name,
-				sizeof(view->entries[i].name));
+		}
+		if (file_add(view, changes[i].name,
+				changes[i].dir ? DT_DIR : DT_UNKNOWN)) {
+			ret = -1;
+			break;
+		}
+	}
 
-#ifndef sun
-		if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
-#endif
-			struct stat buf;
-			if (!fstatat(view->fd, entry->d_name, &buf, 0)) {
-				view->entries[i].type =
-					S_ISDIR(buf.st_mode) ? DT_DIR : DT_REG;
-			} else {
-				view->entries[i].type = DT_REG;
-			}
-#ifndef sun
-		} else {
-			view->entries[i].type = entry->d_type;
+	/* the cursor goes to the next entry if its entry was removed */
+	id = ARENA_ERR;
+	for (i = file_position(view); !EMPTY(view) && i < sorted; i++) {
+		if (view->entries[i].flags & ENTRY_REMOVED) continue;
+		id = view->entries[i].name;
+		break;
+	}
+
+	kept = live = 0;
+	for (i = j = 0; i < view->length; i++) {
+		struct entry *e = &view->entries[i];
+		if (i == sorted) kept = j;
+		if (e->flags & ENTRY_REMOVED) {
+			if (e->flags & ENTRY_UNRESOLVED) view->unresolved--;
+			continue;
 		}
-#endif
-		i++;
+		live += e->length + e->key_length + 2;
+		view->entries[j++] = *e;
 	}
+	if (i == sorted) kept = j;
+	view->length = j;
+
+	sort_merge(view->entries, kept, view->length, &view->names);
+	view->resolving = 0;
+
+	if (file_filter(view, file_locate(view, id))) ret = -1;
+
+	/* drop the names of the removed entries once they waste most of
+	 * the arena */
+	if (view->names.length > ARENA_COMPACT &&
+			view->names.length / 2 > live && file_compact(view))
+		ret = -1;
+
+	/* the listing is now up to date with the directory */
+	if (!fstat(view->fd, &st)) cache_stamp(view, &st);
+	return ret;
+}
 
-	qsort(view->entries, length, sizeof(struct entry), file_sort);
+/* Start listing the directory of the view, only the first batch is read,
+ * the rest is read by calling file_load until it returns 0. */
+int file_ls(struct view *view) {
 
-	closedir(dp);
-	view->length = length;
-	if (view->length && view->selected >= view->length) {
-		view->selected = view->length - 1;
+	struct stat st;
+	struct dir *dir;
+	char *pending;
+
+	if (fstat(view->fd, &st)) return -1;
+	if (!cache_get(view, &st)) return 0;
+
+	dir = dir_open(view->fd);
+	if (!dir) return -1;
+
+	/* follow the selected entry if the same directory is listed again */
+	pending = NULL;
+	if (view->pending) {
+		pending = view->pending;
+		view->pending = NULL;
+	} else if (!EMPTY(view)) {
+		size_t length = SELECTED(view).length + 1;
+		pending = malloc(length);
+		if (pending) memcpy(pending, NAME(view, SELECTED(view)), length);
 	}
+
+	file_free(view);
+	cache_stamp(view, &st);
+	view->outdated = 0;
+	view->pending = pending;
+	view->loading = dir;
+	view->started = clock_monotonic();
 	view->scroll = 0;
-	lseek(view->fd, 0, SEEK_SET);
-	return 0;
+	return -(file_load(view) < 0);
 }
 
 int file_select(struct view *view, const char *path) {
 	size_t i = 0;
-	while (i < view->length) {
-		if (!strncmp(view->entries[i].name, path,
-			     sizeof(view->entries[i].name))) {
+	while (i < view->count) {
+		if (!strcmp(NAME(view, ENTRY(view, i)), path)) {
 			view->selected = i;
 			return 0;
 		}
 		i++;
 	}
+	if (view->loading) { /* select it once it is read */
+		size_t length = strlen(path) + 1;
+		free(view->pending);
+		view->pending = malloc(length);
+		if (view->pending) memcpy(view->pending, path, length);
+	}
 	return -1;
 }
 
-int file_move_entry(struct view *view, struct entry *entry) {
-	int fd = open(client.copy_path, O_DIRECTORY), ret;
-	if (fd < 0) return -1;
-	ret = file_move(client.copy_path, fd, entry->name,
-				view->fd, view->path, entry->name);
-	close(fd);
-	return ret;
-}
-
-#ifdef __linux__
-#define lseek lseek64
-#define off_t off64_t
-#endif
-
-#if !defined(__linux__) && !defined(__FreeBSD__)
-#define NO_COPY_FILE_RANGE
-#endif
-
-int file_copy_entry(struct view *view, struct entry *entry) {
+/* Copy the entry name of the directory srcdir at srcpath to dstdir, the
+ * progress is added to copy. A file is copied under a temporary name and
+ * renamed once complete, it is skipped if its copy was completed before
+ * the copy was interrupted. */
+int file_copy_entry(int srcdir, const char *srcpath, int dstdir,
+			const char *name, struct copy *copy) {
 
-	struct stat st;
-	int fd, dstfd, srcfd;
-
-	fd = openat(view->fd, entry->name, 0);
-	if (fd > -1) {
-		close(fd);
-		errno = EEXIST;
-		return -1;
-	}
+	char partial[PATH_MAX];
+	struct journal *journal;
+	struct stat st, dst;
+	int dstfd, srcfd, ret;
 
-	fd = open(client.copy_path, O_DIRECTORY);
-	if (fd < 0) return -1;
-	srcfd = openat(fd, entry->name, O_RDONLY);
-	close(fd);
+	srcfd = openat(srcdir, name, O_RDONLY);
 	if (srcfd < 0) return -1;
 
 	if (fstat(srcfd, &st)) {
@@ -284,108 +604,184 @@ int file_copy_entry(struct view *view, struct entry *entry) {
 
 	if (S_ISDIR(st.st_mode)) {
 		char buf[PATH_MAX];
-		snprintf(V(buf), "%s/%s", client.copy_path, client.copy->name);
-		return spawn("cp", 1, 1, "-r", buf, view->path);
+		close(srcfd);
+		if (snprintf(V(buf), "%s/%s", srcpath, name) >=
+				(int)sizeof(buf)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		return copy_tree(buf, dstdir, name, copy);
 	}
 
-	dstfd = openat(view->fd, entry->name, O_WRONLY|O_CREAT, st.st_mode);
-	if (dstfd < 0) return -1;
+	journal = copy ? copy->journal : NULL;
+	if (journal_finished(journal, name)) {
+		close(srcfd);
+		copy_resumed(copy, st.st_size);
+		return 0;
+	}
+	/* including when resumed, it was created since the interruption */
+	if (!fstatat(dstdir, name, &dst, AT_SYMLINK_NOFOLLOW)) {
+		close(srcfd);
+		errno = EEXIST;
+		return -1;
+	}
+	if (copy_partial(name, V(partial))) {
+		close(srcfd);
+		return -1;
+	}
+	dstfd = openat(dstdir, partial, O_WRONLY|O_CREAT|
+			(journal_partial(journal, name) ? 0 : O_TRUNC),
+			st.st_mode);
+	if (dstfd < 0) {
+		close(srcfd);
+		return -1;
+	}
 
-	return file_copy(srcfd, dstfd, 0);
+	ret = file_copy(srcfd, dstfd, copy, name);
+	if (ret < 0) {
+		int error = errno;
+		if (error != ECANCELED || !copy_interrupted(copy))
+			unlinkat(dstdir, partial, 0);
+		errno = error;
+		return -1;
+	}
+	if (copy_rename(dstdir, partial, name)) return -1;
+	journal_file(journal, name);
+	copy_done(copy, ret);
+	return 0;
 }
 
-int file_copy(int src, int dst, int usebuf) {
-
-	size_t length, ret;
+/* Copy the content of src to dst and close both. A copy-on-write clone is
+ * tried first, then copy_file_range and then a read and write loop. Only
+ * the data regions of sparse files are copied.
+ * The bytes are added to the progress of copy if not NULL and the copied
+ * ranges to its journal under path. Returns the strategy used or -1 on
+ * error. */
+int file_copy(int src, int dst, struct copy *copy, const char *path) {
 
-#ifdef NO_COPY_FILE_RANGE
-	if (usebuf == -1) return -1;
+	struct stat st;
+	int ret, error;
+
+	if (fstat(src, &st)) {
+		ret = -1;
+#ifdef FICLONE
+	/* only shares the blocks of the source on btrfs, xfs, ... */
+	} else if (!ioctl(dst, FICLONE, src)) {
+		ret = COPY_CLONE;
+		copy_bytes(copy, st.st_size, 0);
 #endif
-
-	length = lseek(src, 0, SEEK_END);
-	if (length == (size_t)-1 ||
-			lseek(src, 0, SEEK_SET) == (off_t)-1) {
-		close(dst);
-		close(src);
-		return -1;
+	} else {
+		ret = copy_file(src, dst, &st, copy, path);
 	}
 
-	ret = 0;
-	for (;;) {
-		ssize_t i;
-		char buf[4096];
-#ifndef NO_COPY_FILE_RANGE
-		if (usebuf) {
+	error = errno;
+	close(dst);
+	close(src);
+	errno = error;
+	return ret;
+}
+
+/* Flush what was written to the file system of fd to the disk. */
+static int file_sync(int fd) {
+#ifdef __linux__
+	return syncfs(fd);
+#else
+	(void)fd;
+	sync();
+	return 0;
 #endif
-			i = read(src, buf, sizeof(buf));
-			if (i <= 0) break;
-			if (write(dst, buf, i) != i) break;
-#ifndef NO_COPY_FILE_RANGE
-		} else {
-			i = copy_file_range(src, 0, dst, 0, length - ret, 0);
-			if (i <= 0) break;
+}
+
+/* Move an entry to another file system: its copy is written to the disk
+ * before the source is removed, a failed copy is removed and leaves the
+ * source untouched. */
+static int file_transfer(const char *oldpath, int srcdir, const char *oldname,
+		int dstdir, const char *newpath, const char *newname,
+		struct copy *copy) {
+
+	char old[PATH_MAX], new[PATH_MAX];
+	struct stat st;
+	int src, dst, ret, error;
+
+	if (fstatat(srcdir, oldname, &st, AT_SYMLINK_NOFOLLOW)) return -1;
+
+	if (S_ISLNK(st.st_mode)) {
+		ssize_t length = readlinkat(srcdir, oldname, V(old));
+		if (length < 0) return -1;
+		if ((size_t)length >= sizeof(old)) {
+			errno = ENAMETOOLONG;
+			return -1;
 		}
-#endif
-		ret += i;
+		old[length] = '\0';
+		if (symlinkat(old, dstdir, newname)) return -1;
+		return unlinkat(srcdir, oldname, 0);
 	}
 
-#ifndef NO_COPY_FILE_RANGE
-	/* retry without copy_file_range if the operation failed */
-	if (ret != length && !usebuf) return file_copy(src, dst, 1);
-#endif
+	if (S_ISDIR(st.st_mode)) {
+		if (snprintf(V(old), "%s/%s", oldpath, oldname) >=
+				(int)sizeof(old) ||
+			snprintf(V(new), "%s/%s", newpath, newname) >=
+				(int)sizeof(new)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		if (copy_tree(old, dstdir, newname, copy) || file_sync(dstdir)) {
+			error = errno;
+			/* the destination was checked to not exist */
+			if (error != EEXIST) purge_tree(new, 0, NULL);
+			errno = error;
+			return -1;
+		}
+		return purge_tree(old, 0, NULL);
+	}
 
+	/* fifos, sockets and devices */
+	if (!S_ISREG(st.st_mode)) {
+		if (mknodat(dstdir, newname, st.st_mode, st.st_rdev)) return -1;
+		return unlinkat(srcdir, oldname, 0);
+	}
+	if (copy_partial(newname, V(new))) return -1;
+	src = openat(srcdir, oldname, O_RDONLY);
+	if (src < 0) return -1;
+	dst = openat(dstdir, new, O_WRONLY|O_CREAT|O_TRUNC,
+			st.st_mode & 07777);
+	if (dst < 0) {
+		close(src);
+		return -1;
+	}
+	ret = copy_file(src, dst, &st, copy, NULL);
+	if (ret > -1 && fsync(dst)) ret = -1;
+	error = errno;
 	close(dst);
 	close(src);
-	if (ret != length) {
+	if (ret < 0 || renameat(dstdir, new, dstdir, newname)) {
+		if (ret > -1) error = errno;
+		unlinkat(dstdir, new, 0);
+		errno = error;
 		return -1;
 	}
-
-	return 0;
+	copy_done(copy, ret);
+	return unlinkat(srcdir, oldname, 0);
 }
 
+/* Rename an entry, or copy it and remove it if it is moved to another file
+ * system, the progress of the copy is then added to copy if not NULL. */
 int file_move(const char *oldpath, int srcdir, const char *oldname,
-		int dstdir, const char *newpath, const char *newname) {
+		int dstdir, const char *newpath, const char *newname,
+		struct copy *copy) {
 
-	int error, fd;
+	struct stat st;
 
-	fd = openat(dstdir, newname, 0);
-	if (fd > -1) {
+	if (!fstatat(dstdir, newname, &st, AT_SYMLINK_NOFOLLOW)) {
 		errno = EEXIST;
-		close(fd);
 		return -1;
 	}
 
-	error = renameat(srcdir, oldname, dstdir, newname);
+	if (!renameat(srcdir, oldname, dstdir, newname)) return 0;
 	/* EXDEV : when trying to move a file to another file system */
-	if (error && errno == EXDEV) {
-		int src, dst;
-		struct stat st;
-
-		if (fstatat(srcdir, oldname, &st, 0)) return -1;
-		/* use a shell command instead of recursively copying files */
-		if (S_ISDIR(st.st_mode)) {
-			char old[PATH_MAX], new[PATH_MAX];
-			snprintf(V(old), "%s/%s", oldpath, oldname);
-			snprintf(V(new), "%s/%s", newpath, newname);
-			return spawn("mv", 1, 1, old, new, NULL);
-		}
-
-		src = openat(srcdir, oldname, O_RDONLY);
-		if (src < 0) return -1;
-		dst = openat(dstdir, newname, O_WRONLY|O_CREAT, st.st_mode);
-		if (dst < 0) {
-			close(src);
-			return -1;
-		}
-		if (!file_copy(src, dst, 1)) {
-			char buf[2048];
-			snprintf(V(buf), "%s/%s", oldpath, oldname);
-			if (!remove(buf)) error = 0;
-		}
-		close(src);
-		close(dst);
-	}
-	return error;
+	if (errno != EXDEV) return -1;
+	return file_transfer(oldpath, srcdir, oldname, dstdir, newpath,
+				newname, copy);
 }
 
 int file_is_directory(const char *path) {
@@ -14,25 +14,78 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define FILE_NOPOS ((size_t)-1)
+
+enum {
+	FILTER_DIRS = 1,
+	FILTER_FILES
+};
+
 struct entry {
-	char name[1024];
-	int type;
-	int selected;
-	void *other; /* custom data for non-regular entry */
+	size_t name; /* offset of the name in the view arena */
+	size_t other; /* offset of custom data for non-regular entry */
+	unsigned int length; /* length of the name */
+	unsigned int key_length; /* length of the collation key */
+	signed char type;
+	signed char selected;
+	unsigned char flags;
+};
+
+#define ENTRY_REMOVED 1
+#define ENTRY_UNRESOLVED 2 /* the type is a guess until the entry is stat'd */
+#define ENTRY_MOVED 4
+
+/* how the content of a file was copied */
+enum {
+	COPY_CLONE, /* by sharing the blocks of the source until written */
+	COPY_RANGE, /* in the kernel by copy_file_range */
+	COPY_BUFFER, /* by reading and writing it */
+	COPY_RING, /* with other small files through io_uring */
+	COPY_STRATEGIES
+};
+
+/* progress of a copy */
+struct copy {
+	size_t files;
+	size_t dirs;
+	off_t bytes;
+	off_t transferred; /* without the holes and the cloned files */
+	size_t strategies[COPY_STRATEGIES]; /* files copied by each one */
+	size_t total; /* number of files to copy if measured */
+	off_t size; /* bytes to copy if measured */
+	size_t resumed; /* files copied before the copy was interrupted */
+	size_t linked; /* files linked to the copy of another link */
+	off_t saved; /* bytes not copied thanks to the links */
+	int paused;
+	int cancelled;
+	struct journal *journal; /* records what is copied if not NULL */
+};
+
+/* entry created or removed from the directory since it was listed */
+struct change {
+	const char *name;
+	int created;
+	int dir; /* the entry is likely a directory */
 };
 
 int file_init(struct view* view, const char *path);
 int file_ls(struct view *view);
+int file_load(struct view *view);
+int file_filter(struct view *view, size_t pos);
+int file_resolve(struct view *view, size_t first, size_t rows);
+int file_resolve_next(struct view *view);
+int file_update(struct view *view, struct change *changes, size_t length);
+size_t file_position(struct view *view);
 int file_reload(struct view *view);
 int file_cd(struct view *view, const char *path);
 int file_up(struct view *view);
 int file_select(struct view *view, const char *path);
-int file_move_entry(struct view *view, struct entry *entry);
 int file_move(const char *oldpath, int srcdir, const char *oldname,
-		int dstdir, const char *newpath, const char *newname);
-int file_copy(int src, int dst, int usebuf);
-int file_copy_entry(struct view *view, struct entry *entry);
+		int dstdir, const char *newpath, const char *newname,
+		struct copy *copy);
+int file_copy(int src, int dst, struct copy *copy, const char *path);
+int file_copy_entry(int srcdir, const char *srcpath, int dstdir,
+			const char *name, struct copy *copy);
 void file_free(struct view *view);
-int file_sort(const void* a, const void* b);
 int file_is_directory(const char *path);
 int file_cd_abs(struct view *view, const char *path);
@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fts.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "util.h"
+#include "index.h"
+
+#define INDEX_FILE "index"
+#define INDEX_TEMP "index.tmp" /* compacted index until it is complete */
+#define INDEX_TEXT "info" /* text index of the previous versions */
+#define INDEX_MAGIC "mz-trash 1"
+#define INDEX_ADDED 'A' /* added by the previous versions, without size */
+#define INDEX_TRASHED 'T'
+#define INDEX_REMOVED 'R'
+/* type, id, length of the data and checksum of the record */
+#define INDEX_HEADER (1 + INDEX_ID + 4 + 4)
+#define INDEX_META 16 /* size and time before the path of a trashed file */
+#define INDEX_COMPACT 1024 /* removed records kept before compacting */
+#define INDEX_PATH 4096 /* longest path of a trashed file */
+
+static void index_encode(char *out, unsigned long n) {
+	out[0] = (n >> 24) & 0xFF;
+	out[1] = (n >> 16) & 0xFF;
+	out[2] = (n >> 8) & 0xFF;
+	out[3] = n & 0xFF;
+}
+
+static unsigned long index_decode(const char *in) {
+	const unsigned char *ptr = (const unsigned char*)in;
+	return ((unsigned long)ptr[0] << 24) | ((unsigned long)ptr[1] << 16) |
+		((unsigned long)ptr[2] << 8) | ptr[3];
+}
+
+/* 64 bits numbers are written as two halves, off_t may be shorter */
+static void index_encode_long(char *out, off_t n) {
+	index_encode(out, ((n >> 16) >> 16) & 0xFFFFFFFFUL);
+	index_encode(&out[4], n & 0xFFFFFFFFUL);
+}
+
+static off_t index_decode_long(const char *in) {
+	return (((off_t)index_decode(in) << 16) << 16) | index_decode(&in[4]);
+}
+
+/* FNV-1a of the record without its checksum */
+static unsigned long index_sum(const char *header, const char *data,
+				size_t length) {
+	unsigned long sum = 2166136261UL;
+	size_t i;
+	for (i = 0; i < INDEX_HEADER - 4; i++)
+		sum = ((sum ^ (unsigned char)header[i]) * 16777619UL) &
+			0xFFFFFFFFUL;
+	for (i = 0; i < length; i++)
+		sum = ((sum ^ (unsigned char)data[i]) * 16777619UL) &
+			0xFFFFFFFFUL;
+	return sum;
+}
+
+/* write a record to out, returns its size */
+static size_t index_record(char *out, int type,
+				const struct index_record *record) {
+	size_t length = 0;
+	out[0] = type;
+	memcpy(&out[1], record->id, INDEX_ID);
+	if (type == INDEX_TRASHED) {
+		index_encode_long(&out[INDEX_HEADER], record->size);
+		index_encode_long(&out[INDEX_HEADER + 8], record->time);
+		memcpy(&out[INDEX_HEADER + INDEX_META], record->path,
+			record->length);
+		length = INDEX_META + record->length;
+	} else if (type == INDEX_ADDED) {
+		memcpy(&out[INDEX_HEADER], record->path, record->length);
+		length = record->length;
+	}
+	index_encode(&out[1 + INDEX_ID], length);
+	index_encode(&out[INDEX_HEADER - 4],
+			index_sum(out, &out[INDEX_HEADER], length));
+	return INDEX_HEADER + length;
+}
+
+static int index_valid_id(const char *id) {
+	size_t i;
+	for (i = 0; i < INDEX_ID; i++)
+		if (id[i] > 'z' || id[i] < 'a') return 0;
+	return 1;
+}
+
+/* Record at ptr, returns a pointer after it or NULL if it is damaged or
+ * doesn't end before end. */
+static const char *index_next(const char *ptr, const char *end,
+				int *type, struct index_record *record) {
+	size_t length, meta;
+	if (end - ptr < INDEX_HEADER) return NULL;
+	*type = ptr[0];
+	meta = *type == INDEX_TRASHED ? INDEX_META : 0;
+	length = index_decode(&ptr[1 + INDEX_ID]);
+	if ((*type != INDEX_ADDED && *type != INDEX_TRASHED &&
+			*type != INDEX_REMOVED) ||
+		!index_valid_id(&ptr[1]) || length > INDEX_PATH + meta ||
+		length < meta || (*type == INDEX_REMOVED && length) ||
+		(size_t)(end - ptr - INDEX_HEADER) < length ||
+		index_decode(&ptr[INDEX_HEADER - 4]) !=
+			index_sum(ptr, &ptr[INDEX_HEADER], length))
+		return NULL;
+	record->id = &ptr[1];
+	record->path = &ptr[INDEX_HEADER + meta];
+	record->length = length - meta;
+	record->size = -1;
+	record->time = 0;
+	if (meta) {
+		record->size = index_decode_long(&ptr[INDEX_HEADER]);
+		record->time = index_decode_long(&ptr[INDEX_HEADER + 8]);
+	}
+	return &ptr[INDEX_HEADER + length];
+}
+
+/* whole content of a file, read at once */
+static char *index_read(int fd, size_t *length) {
+
+	struct stat st;
+	char *data;
+	ssize_t n;
+
+	if (fstat(fd, &st)) return NULL;
+	data = malloc(AZ(st.st_size));
+	if (!data) return NULL;
+	*length = 0;
+	while (*length < (size_t)st.st_size) {
+		n = read(fd, &data[*length], st.st_size - *length);
+		if (n < 0) {
+			free(data);
+			return NULL;
+		}
+		if (!n) break;
+		*length += n;
+	}
+	return data;
+}
+
+/* Open the index and lock it against the other threads and instances, it
+ * is created if needed. A compaction replaces the file, the lock is taken
+ * again if it happened while waiting for it. */
+static int index_lock(int trash) {
+	for (;;) {
+		struct stat locked, current;
+		int fd = openat(trash, INDEX_FILE,
+				O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+		if (fd < 0) return -1;
+		if (flock(fd, LOCK_EX) || fstat(fd, &locked)) {
+			close(fd);
+			return -1;
+		}
+		if (!fstatat(trash, INDEX_FILE, &current, 0) &&
+				current.st_ino == locked.st_ino &&
+				current.st_dev == locked.st_dev) {
+			if (locked.st_size ||
+				write(fd, V(INDEX_MAGIC)) == sizeof(INDEX_MAGIC))
+				return fd;
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+}
+
+/* records are appended by a single write to not be mixed */
+static int index_append(int trash, const char *data, size_t length) {
+	ssize_t n;
+	int fd = index_lock(trash);
+	if (fd < 0) return -1;
+	n = write(fd, data, length);
+	close(fd);
+	if (n == (ssize_t)length) return 0;
+	if (n >= 0) errno = ENOSPC;
+	return -1;
+}
+
+/* the file of the record was trashed */
+int index_add(int trash, const struct index_record *record) {
+	char *buf;
+	int ret;
+	if (record->length > INDEX_PATH) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	buf = malloc(INDEX_HEADER + INDEX_META + record->length);
+	if (!buf) return -1;
+	ret = index_append(trash, buf,
+			index_record(buf, INDEX_TRASHED, record));
+	free(buf);
+	return ret;
+}
+
+/* the files of the ids left the trash */
+int index_remove(int trash, const char **ids, size_t count) {
+	char *buf;
+	size_t i;
+	int ret;
+	if (!count) return 0;
+	buf = malloc(count * INDEX_HEADER);
+	if (!buf) return -1;
+	for (i = 0; i < count; i++) {
+		struct index_record record;
+		record.id = ids[i];
+		index_record(&buf[i * INDEX_HEADER], INDEX_REMOVED, &record);
+	}
+	ret = index_append(trash, buf, count * INDEX_HEADER);
+	free(buf);
+	return ret;
+}
+
+/* Replace the index by the records of the files in the trash, the new one
+ * is written to the disk before it replaces the old one. */
+static int index_rewrite(int trash, struct index *index) {
+
+	char *buf;
+	size_t i, length, size;
+	int fd, ret;
+
+	size = sizeof(INDEX_MAGIC);
+	for (i = 0; i < index->count; i++)
+		size += INDEX_HEADER + INDEX_META + index->records[i].length;
+	buf = malloc(size);
+	if (!buf) return -1;
+	memcpy(buf, V(INDEX_MAGIC));
+	length = sizeof(INDEX_MAGIC);
+	/* the files not measured yet are kept without size */
+	for (i = 0; i < index->count; i++)
+		length += index_record(&buf[length],
+				index->records[i].size < 0 ?
+				INDEX_ADDED : INDEX_TRASHED,
+				&index->records[i]);
+
+	ret = -1;
+	fd = openat(trash, INDEX_TEMP, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,
+			0644);
+	if (fd < 0) goto end;
+	if (write(fd, buf, length) == (ssize_t)length && !fsync(fd) &&
+			!renameat(trash, INDEX_TEMP, trash, INDEX_FILE))
+		ret = 0;
+	close(fd);
+	if (ret) unlinkat(trash, INDEX_TEMP, 0);
+end:
+	free(buf);
+	return ret;
+}
+
+static int index_compare(const void *a, const void *b) {
+	return memcmp(*(const char**)a, *(const char**)b, INDEX_ID);
+}
+
+/* Keep the records of the files added and not removed since. Returns the
+ * number of removed records. */
+static int index_replay(struct index *index, int *damaged) {
+
+	const char *ptr, *end, **removed;
+	size_t i, j, length;
+
+	index->records = malloc((index->length / INDEX_HEADER + 1) *
+				sizeof(struct index_record));
+	removed = malloc((index->length / INDEX_HEADER + 1) *
+				sizeof(const char*));
+	if (!index->records || !removed) {
+		free(removed);
+		return -1;
+	}
+
+	length = 0;
+	*damaged = index->length < sizeof(INDEX_MAGIC) ||
+		memcmp(index->data, V(INDEX_MAGIC));
+	ptr = index->data + (*damaged ? 0 : sizeof(INDEX_MAGIC));
+	end = index->data + index->length;
+	while (ptr < end) {
+		struct index_record record;
+		const char *next;
+		int type;
+		next = index_next(ptr, end, &type, &record);
+		/* skip to the next valid record */
+		if (!next) {
+			*damaged = 1;
+			ptr++;
+			continue;
+		}
+		if (type != INDEX_REMOVED)
+			index->records[index->count++] = record;
+		else
+			removed[length++] = record.id;
+		ptr = next;
+	}
+
+	qsort(removed, length, sizeof(const char*), index_compare);
+	for (i = j = 0; length && i < index->count; i++) {
+		const char *id = index->records[i].id;
+		if (bsearch(&id, removed, length, sizeof(const char*),
+				index_compare))
+			continue;
+		index->records[j++] = index->records[i];
+	}
+	if (length) index->count = j;
+	free(removed);
+	for (i = 0; i < index->count; i++) {
+		if (index->records[i].size > 0)
+			index->size += index->records[i].size;
+	}
+	return length;
+}
+
+/* Read the index locked as fd. It is compacted if it was damaged or if
+ * most of it are removed files. */
+static int index_parse(int trash, int fd, struct index *index) {
+
+	int removed, damaged;
+
+	memset(index, 0, sizeof(*index));
+	index->data = index_read(fd, &index->length);
+	if (!index->data) goto fail;
+	removed = index_replay(index, &damaged);
+	if (removed < 0) goto fail;
+	if ((damaged || (removed > INDEX_COMPACT &&
+				(size_t)removed > index->count)) &&
+			index_rewrite(trash, index))
+		goto fail;
+	return 0;
+fail:
+	index_free(index);
+	return -1;
+}
+
+/* read the files in the trash from its index */
+int index_load(int trash, struct index *index) {
+	int ret, fd = index_lock(trash);
+	if (fd < 0) return -1;
+	ret = index_parse(trash, fd, index);
+	close(fd);
+	return ret;
+}
+
+void index_free(struct index *index) {
+	free(index->data);
+	free(index->records);
+	memset(index, 0, sizeof(*index));
+}
+
+/* Convert the text index of the previous versions, a line per trashed
+ * file with its id, a space and its original path. */
+static int index_convert(int trash) {
+
+	struct index index;
+	char *line, *end;
+	int fd;
+
+	fd = openat(trash, INDEX_TEXT, O_RDONLY|O_CLOEXEC);
+	if (fd < 0) return errno == ENOENT ? 0 : -1;
+	memset(&index, 0, sizeof(index));
+	index.data = index_read(fd, &index.length);
+	close(fd);
+	if (!index.data) return -1;
+	/* a line has at least an id and a space */
+	index.records = malloc((index.length / (INDEX_ID + 1) + 1) *
+				sizeof(struct index_record));
+	if (!index.records) goto fail;
+
+	for (line = index.data; line < &index.data[index.length];
+			line = end + 1) {
+		struct index_record *record;
+		end = memchr(line, '\n', &index.data[index.length] - line);
+		if (!end) end = &index.data[index.length];
+		if (end - line <= INDEX_ID + 1 || line[INDEX_ID] != ' ' ||
+				!index_valid_id(line) ||
+				end - line - INDEX_ID - 1 > INDEX_PATH ||
+				memchr(line, '\0', end - line))
+			continue;
+		record = &index.records[index.count++];
+		record->id = line;
+		record->path = &line[INDEX_ID + 1];
+		record->length = end - record->path;
+		record->size = -1;
+		record->time = 0;
+	}
+	if (index_rewrite(trash, &index)) goto fail;
+	index_free(&index);
+	return unlinkat(trash, INDEX_TEXT, 0);
+fail:
+	index_free(&index);
+	return -1;
+}
+
+/* Bytes freed by removing the file at path and its content, the files
+ * with other links are not counted. */
+off_t index_usage(const char *path) {
+
+	char *paths[2];
+	FTS *fts;
+	FTSENT *ent;
+	off_t size;
+
+	paths[0] = (char*)path;
+	paths[1] = NULL;
+	fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+	if (!fts) return -1;
+	size = 0;
+	while ((ent = fts_read(fts))) {
+		if (ent->fts_info == FTS_DP || ent->fts_info == FTS_NS ||
+				ent->fts_info == FTS_ERR)
+			continue;
+		if (!S_ISDIR(ent->fts_statp->st_mode) &&
+				ent->fts_statp->st_nlink > 1)
+			continue;
+		size += (off_t)ent->fts_statp->st_blocks * 512;
+	}
+	fts_close(fts);
+	return size;
+}
+
+/* Measure the files of the trash at path trashed by the previous versions,
+ * their time is the last change of their status, which renaming them to
+ * the trash updated. Returns the number of files measured. */
+static size_t index_measure(const char *path, struct index *index) {
+	size_t i, measured = 0;
+	for (i = 0; i < index->count; i++) {
+		struct index_record *record = &index->records[i];
+		char buf[PATH_MAX];
+		struct stat st;
+		if (record->size >= 0 ||
+			snprintf(V(buf), "%s/%.*s", path, INDEX_ID,
+				record->id) >= (int)sizeof(buf))
+			continue;
+		record->time = lstat(buf, &st) ? time(NULL) : st.st_ctime;
+		record->size = index_usage(buf);
+		if (record->size < 0) record->size = 0;
+		index->size += record->size;
+		measured++;
+	}
+	return measured;
+}
+
+/* Replay the index of the trash at path, converting the one of the
+ * previous versions if there's no other and measuring the files it
+ * trashed, once. */
+int index_init(int trash, const char *path) {
+
+	struct index index;
+	struct stat st;
+	int fd, ret;
+
+	if (fstatat(trash, INDEX_FILE, &st, 0)) {
+		if (errno != ENOENT || index_convert(trash)) return -1;
+	} else {
+		/* left if interrupted after the conversion */
+		unlinkat(trash, INDEX_TEXT, 0);
+	}
+	fd = index_lock(trash);
+	if (fd < 0) return -1;
+	ret = index_parse(trash, fd, &index);
+	if (!ret) {
+		if (index_measure(path, &index))
+			ret = index_rewrite(trash, &index);
+		index_free(&index);
+	}
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Index of the trash in its directory, an append-only log of records with
+ * a fixed size header: a file added with its size, the time it was trashed
+ * and its original path or an id removed from the trash. It is replayed
+ * when loaded, a record damaged by a crash is dropped and the log is
+ * compacted once most of it describes removed files. */
+#define INDEX_ID 32 /* length of the ids of the trashed files */
+
+struct index_record {
+	const char *id; /* INDEX_ID letters, not null-terminated */
+	const char *path;
+	size_t length;
+	off_t size; /* bytes used by the trashed file and its content */
+	time_t time; /* when it was trashed */
+};
+
+struct index {
+	char *data; /* content of the log */
+	size_t length;
+	struct index_record *records; /* files in the trash */
+	size_t count;
+	off_t size; /* bytes used by the files in the trash */
+};
+
+int index_init(int trash, const char *path);
+off_t index_usage(const char *path);
+int index_add(int trash, const struct index_record *record);
+int index_remove(int trash, const char **ids, size_t count);
+int index_load(int trash, struct index *index);
+void index_free(struct index *index);
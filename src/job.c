@@ -0,0 +1,542 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "view.h"
+#include "file.h"
+#include "copy.h"
+#include "trash.h"
+#include "purge.h"
+#include "clock.h"
+#include "util.h"
+#include "strlcpy.h"
+#include "journal.h"
+#include "job.h"
+
+#define JOB_KEEP 8 /* number of ended jobs kept to be listed */
+#define JOB_RESUME 64 /* interrupted copies resumed at once */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+
+static struct {
+	struct job *first; /* in the order they were submitted */
+	struct job *last;
+	int fds[2]; /* written once for every job that ended */
+	int ids;
+	int started;
+	int quit;
+	pthread_t thread;
+} jobs;
+
+struct job *job_new(int type, const char *src, const char *dst) {
+	struct job *job = calloc(1, sizeof(struct job));
+	if (!job) return NULL;
+	job->type = type;
+	STRCPY(job->src, src);
+	STRCPY(job->dst, dst);
+	return job;
+}
+
+int job_add(struct job *job, const char *name) {
+	if (arena_add(&job->names, name, strlen(name)) == ARENA_ERR)
+		return -1;
+	job->length++;
+	return 0;
+}
+
+/* stop recording the copy, its journal is kept if it can be resumed */
+static void job_unjournal(struct job *job, int keep) {
+	if (!job->journal) return;
+	journal_close(job->journal, keep);
+	free(job->journal);
+	job->journal = NULL;
+	job->copy.journal = NULL;
+}
+
+void job_discard(struct job *job) {
+	if (!job) return;
+	job_unjournal(job, 1);
+	arena_free(&job->names);
+	free(job);
+}
+
+/* Record the copy to resume it if mz is killed, the header of the journal
+ * describes the job. The copy is still done if it can't be recorded. */
+static void job_journal(struct job *job) {
+
+	char *header;
+	size_t length;
+
+	if (job->type != JOB_COPY || job->journal) return;
+	length = sizeof("copy") + strlen(job->src) + 1 + strlen(job->dst) + 1 +
+		job->names.length + 1;
+	header = malloc(length);
+	job->journal = malloc(sizeof(struct journal));
+	if (!header || !job->journal) goto fail;
+	memcpy(header, "copy", sizeof("copy"));
+	length = sizeof("copy");
+	strcpy(&header[length], job->src);
+	length += strlen(job->src) + 1;
+	strcpy(&header[length], job->dst);
+	length += strlen(job->dst) + 1;
+	memcpy(&header[length], job->names.data, job->names.length);
+	length += job->names.length;
+	header[length++] = '\0';
+	if (journal_create(job->journal, job->id, header, length)) goto fail;
+	free(header);
+	return;
+fail:
+	free(header);
+	free(job->journal);
+	job->journal = NULL;
+}
+
+static void job_signal(void) {
+	char c = 0;
+	if (write(jobs.fds[1], &c, 1) != 1) {
+		/* the pipe is full, the end will still be read */
+	}
+}
+
+static void job_run(struct job *job) {
+
+	const char *name;
+	struct stat dst;
+	size_t i;
+	int srcfd, dstfd, ret;
+
+	srcfd = open(job->src, O_DIRECTORY);
+	dstfd = job->type >= JOB_DELETE ? -1 : open(job->dst, O_DIRECTORY);
+	if (srcfd < 0 || (job->type < JOB_DELETE && dstfd < 0)) {
+		job->error = errno;
+		goto end;
+	}
+
+	/* know how much there is to copy to tell when it will end, moves
+	 * only copy what is on another file system */
+	if (job->type == JOB_MOVE && fstat(dstfd, &dst)) {
+		job->error = errno;
+		goto end;
+	}
+	name = job->names.data;
+	for (i = 0; job->type < JOB_DELETE && i < job->length; i++) {
+		char path[PATH_MAX];
+		struct stat st;
+		if (job->type == JOB_MOVE &&
+			(fstatat(srcfd, name, &st, AT_SYMLINK_NOFOLLOW) ||
+				st.st_dev == dst.st_dev)) {
+			name += strlen(name) + 1;
+			continue;
+		}
+		snprintf(V(path), "%s/%s", job->src, name);
+		copy_measure(path, &job->copy);
+		name += strlen(name) + 1;
+	}
+
+	if (job->type == JOB_CLEAR) {
+		size_t length = 0;
+		if (trash_clear(&job->names)) job->error = errno;
+		for (i = 0; i < job->names.length;
+				i += strlen(&job->names.data[i]) + 1)
+			length++;
+		pthread_mutex_lock(&lock);
+		job->length = length;
+		pthread_mutex_unlock(&lock);
+	}
+
+	name = job->names.data;
+	for (i = 0; i < job->length; i++) {
+		if (copy_wait(&job->copy)) {
+			job->error = errno;
+			break;
+		}
+		switch (job->type) {
+		case JOB_COPY:
+			ret = file_copy_entry(srcfd, job->src, dstfd, name,
+						&job->copy);
+			break;
+		case JOB_MOVE:
+			ret = file_move(job->src, srcfd, name,
+					dstfd, job->dst, name, &job->copy);
+			break;
+		case JOB_DELETE:
+			ret = trash_send(srcfd, job->src, (char*)name);
+			break;
+		default:
+			ret = purge_tree(name, 1, &job->copy);
+			break;
+		}
+		if (ret && !job->error) job->error = errno;
+		name += strlen(name) + 1;
+		pthread_mutex_lock(&lock);
+		job->done++;
+		pthread_mutex_unlock(&lock);
+	}
+end:
+	if (srcfd > -1) close(srcfd);
+	if (dstfd > -1) close(dstfd);
+}
+
+static void *job_executor(void *arg) {
+
+	struct job *job;
+
+	(void)arg;
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		for (job = jobs.first; job; job = job->next)
+			if (job->state == JOB_QUEUED) break;
+		if (jobs.quit) break;
+		if (!job) {
+			pthread_cond_wait(&queued, &lock);
+			continue;
+		}
+		job->state = JOB_RUNNING;
+		job->started = clock_monotonic();
+		/* set before the main thread can read the progress */
+		job->copy.journal = job->journal;
+		pthread_mutex_unlock(&lock);
+
+		job_run(job);
+
+		pthread_mutex_lock(&lock);
+		if (copy_cancelled(&job->copy)) job->state = JOB_CANCELLED;
+		else job->state = job->error ? JOB_FAILED : JOB_DONE;
+		/* resumed on the next start if it was stopped by quitting */
+		job_unjournal(job, jobs.quit && job->state == JOB_CANCELLED);
+		job_signal();
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+static int job_start(void) {
+	if (jobs.started) return 0;
+	if (pipe(jobs.fds)) return -1;
+	fcntl(jobs.fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(jobs.fds[1], F_SETFL, O_NONBLOCK);
+	fcntl(jobs.fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(jobs.fds[1], F_SETFD, FD_CLOEXEC);
+	if (pthread_create(&jobs.thread, NULL, job_executor, NULL)) {
+		close(jobs.fds[0]);
+		close(jobs.fds[1]);
+		return -1;
+	}
+	jobs.started = 1;
+	return 0;
+}
+
+/* queue the job, it is freed by the queue. Returns its id or -1 */
+int job_submit(struct job *job) {
+	if (job_start()) return -1;
+	pthread_mutex_lock(&lock);
+	job->id = ++jobs.ids;
+	job_journal(job);
+	if (jobs.last) jobs.last->next = job;
+	else jobs.first = job;
+	jobs.last = job;
+	pthread_cond_signal(&queued);
+	pthread_mutex_unlock(&lock);
+	return job->id;
+}
+
+/* readable when a job ended, -1 before the first job */
+int job_fd(void) {
+	return jobs.started ? jobs.fds[0] : -1;
+}
+
+/* drop the oldest ended jobs that were already shown */
+static void job_prune(void) {
+	struct job *job, *prev, *next;
+	size_t ended;
+	ended = 0;
+	for (job = jobs.first; job; job = job->next)
+		if (job->reported) ended++;
+	prev = NULL;
+	for (job = jobs.first; job && ended > JOB_KEEP; job = next) {
+		next = job->next;
+		if (!job->reported) {
+			prev = job;
+			continue;
+		}
+		if (prev) prev->next = next;
+		else jobs.first = next;
+		if (jobs.last == job) jobs.last = prev;
+		job_discard(job);
+		ended--;
+	}
+}
+
+/* next job that ended and was not shown yet, NULL if there is none */
+struct job *job_ended(void) {
+
+	struct job *job;
+	char buf[64];
+
+	while (read(jobs.fds[0], buf, sizeof(buf)) > 0) ;
+	pthread_mutex_lock(&lock);
+	job_prune();
+	for (job = jobs.first; job; job = job->next) {
+		if (job->state < JOB_DONE || job->reported) continue;
+		job->reported = 1;
+		break;
+	}
+	pthread_mutex_unlock(&lock);
+	return job;
+}
+
+/* a job is queued or running */
+int job_active(void) {
+	struct job *job;
+	int active = 0;
+	pthread_mutex_lock(&lock);
+	for (job = jobs.first; job && !active; job = job->next)
+		active = job->state < JOB_DONE;
+	pthread_mutex_unlock(&lock);
+	return active;
+}
+
+static const char *job_name(struct job *job) {
+	switch (job->type) {
+	case JOB_COPY: return "copy";
+	case JOB_MOVE: return "move";
+	case JOB_DELETE: return "delete";
+	case JOB_CLEAR: return "clear";
+	default: return "purge";
+	}
+}
+
+static void job_size(char *out, size_t length, double size) {
+	if (size >= 1024.0 * 1024 * 1024)
+		snprintf(out, length, "%.1f GiB", size / (1024 * 1024 * 1024));
+	else
+		snprintf(out, length, "%.1f MiB", size / (1024 * 1024));
+}
+
+/* Progress of the running job: files and bytes done, throughput and
+ * estimated time left. Returns 0 if no job is running. */
+int job_status(char *out, size_t length) {
+
+	struct job *job;
+	struct copy copy;
+	char done[32], total[32];
+	double now, running, rate;
+	size_t queued, len;
+
+	pthread_mutex_lock(&lock);
+	queued = 0;
+	for (job = jobs.first; job; job = job->next)
+		if (job->state == JOB_QUEUED) queued++;
+	for (job = jobs.first; job; job = job->next)
+		if (job->state == JOB_RUNNING) break;
+	if (!job) {
+		pthread_mutex_unlock(&lock);
+		*out = '\0';
+		return 0;
+	}
+
+	len = snprintf(out, length, "%s%s ", job->paused ? "paused " : "",
+			job_name(job));
+	if (len >= length) goto end;
+	copy_read(&job->copy, &copy);
+	if (job->type >= JOB_PURGE) {
+		job_size(V(done), copy.bytes);
+		len += snprintf(&out[len], length - len, "%lu files  %s",
+				(unsigned long)copy.files, done);
+		goto end;
+	}
+	/* moves within a file system copy nothing */
+	if (job->type == JOB_DELETE || (job->type == JOB_MOVE && !copy.total)) {
+		len += snprintf(&out[len], length - len, "%lu/%lu",
+				(unsigned long)job->done,
+				(unsigned long)job->length);
+		goto end;
+	}
+
+	now = clock_monotonic();
+	running = now - job->started - job->idle -
+		(job->paused ? now - job->paused : 0);
+	rate = running > 0 ? copy.bytes / running : 0;
+	job_size(V(done), copy.bytes);
+	job_size(V(total), copy.size);
+	len += snprintf(&out[len], length - len,
+			"%lu/%lu files  %s/%s  %.1f MiB/s",
+			(unsigned long)copy.files, (unsigned long)copy.total,
+			done, total, rate / (1024 * 1024));
+	if (len < length && rate > 0 && copy.size > copy.bytes) {
+		long left = (copy.size - copy.bytes) / rate;
+		len += snprintf(&out[len], length - len, "  ETA %ld:%02ld",
+				left / 60, left % 60);
+	}
+end:
+	if (len < length && queued)
+		snprintf(&out[len], length - len, "  +%lu queued",
+				(unsigned long)queued);
+	pthread_mutex_unlock(&lock);
+	return 1;
+}
+
+/* one line description of the jobs */
+int job_list(char *out, size_t length) {
+
+	static const char *states[] = {
+		"queued", "running", "done", "failed", "cancelled"
+	};
+	struct job *job;
+	size_t len;
+
+	len = 0;
+	*out = '\0';
+	pthread_mutex_lock(&lock);
+	for (job = jobs.first; job && len < length; job = job->next) {
+		len += snprintf(&out[len], length - len, "%s%d %s %s %lu/%lu",
+				len ? ", " : "", job->id, job_name(job),
+				job->paused ? "paused" : states[job->state],
+				(unsigned long)job->done,
+				(unsigned long)job->length);
+	}
+	pthread_mutex_unlock(&lock);
+	if (!len) snprintf(out, length, "no jobs");
+	return 0;
+}
+
+/* pause, resume or cancel the job with the given id, or the running one if
+ * id is 0 */
+int job_control(int id, int action) {
+
+	struct job *job;
+	int ret;
+
+	pthread_mutex_lock(&lock);
+	for (job = jobs.first; job; job = job->next) {
+		if (id ? job->id == id : job->state == JOB_RUNNING) break;
+	}
+	ret = -1;
+	errno = ESRCH;
+	if (!job || job->state > JOB_RUNNING) goto end;
+	errno = EINVAL;
+	switch (action) {
+	case JOB_PAUSE:
+		if (job->state != JOB_RUNNING || job->paused) break;
+		job->paused = clock_monotonic();
+		copy_control(&job->copy, 1, 0);
+		ret = 0;
+		break;
+	case JOB_RESUME:
+		if (!job->paused) break;
+		job->idle += clock_elapsed(job->paused);
+		job->paused = 0;
+		copy_control(&job->copy, 0, 0);
+		ret = 0;
+		break;
+	case JOB_CANCEL:
+		if (job->state == JOB_QUEUED) {
+			job->state = JOB_CANCELLED;
+			job_unjournal(job, 0);
+			job_signal();
+		}
+		job->paused = 0;
+		copy_control(&job->copy, 0, 1);
+		ret = 0;
+		break;
+	}
+end:
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+/* the job described by the header of an interrupted journal */
+static struct job *job_load(struct journal *journal) {
+
+	const char *src, *dst, *name;
+	struct job *job;
+
+	if (strcmp(journal->header, "copy")) return NULL;
+	src = journal->header + sizeof("copy");
+	dst = src + strlen(src) + 1;
+	job = job_new(JOB_COPY, src, dst);
+	if (!job) return NULL;
+	for (name = dst + strlen(dst) + 1; *name; name += strlen(name) + 1) {
+		if (job_add(job, name)) {
+			job_discard(job);
+			return NULL;
+		}
+	}
+	job->journal = journal;
+	return job;
+}
+
+/* Queue again the copies that were interrupted, what was copied is
+ * skipped. Returns the number of copies resumed. */
+int job_resume(void) {
+
+	struct journal *journals[JOB_RESUME];
+	size_t count, i;
+	int resumed;
+
+	count = journal_interrupted(journals, LENGTH(journals));
+	resumed = 0;
+	for (i = 0; i < count; i++) {
+		struct job *job = job_load(journals[i]);
+		if (!job) {
+			journal_close(journals[i], 1);
+			free(journals[i]);
+			continue;
+		}
+		if (job_submit(job) < 0) {
+			job_discard(job);
+			continue;
+		}
+		resumed++;
+	}
+	return resumed;
+}
+
+/* cancel the jobs left and wait for the running one to stop */
+void job_free(void) {
+	struct job *job;
+	if (!jobs.started) return;
+	pthread_mutex_lock(&lock);
+	jobs.quit = 1;
+	for (job = jobs.first; job; job = job->next)
+		if (job->state == JOB_RUNNING)
+			copy_control(&job->copy, 0, COPY_INTERRUPTED);
+	pthread_cond_signal(&queued);
+	pthread_mutex_unlock(&lock);
+	pthread_join(jobs.thread, NULL);
+	while (jobs.first) {
+		job = jobs.first;
+		jobs.first = job->next;
+		job_discard(job);
+	}
+	close(jobs.fds[0]);
+	close(jobs.fds[1]);
+	jobs.started = 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Paste, move and delete run as jobs on a background thread, one after the
+ * other. The end of a job is signaled on job_fd. A purge removes the files
+ * set aside from the trashes, its names are absolute paths. A clear sets
+ * every trash aside then purges them, between the deletes using them. */
+enum {
+	JOB_COPY,
+	JOB_MOVE,
+	JOB_DELETE,
+	JOB_PURGE,
+	JOB_CLEAR
+};
+
+enum {
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_DONE,
+	JOB_FAILED,
+	JOB_CANCELLED
+};
+
+enum {
+	JOB_PAUSE,
+	JOB_RESUME,
+	JOB_CANCEL
+};
+
+struct job {
+	int id;
+	int type;
+	int state;
+	int error; /* errno of the first failure */
+	int reported; /* its end was shown */
+	char src[1024]; /* directory of the entries */
+	char dst[1024];
+	struct arena names; /* names of the entries, one after the other */
+	size_t length; /* number of entries */
+	size_t done; /* entries processed */
+	struct copy copy;
+	struct journal *journal; /* of a copy, to resume it if interrupted */
+	double started;
+	double paused; /* when the job was paused, 0 if it is not */
+	double idle; /* time spent paused */
+	struct job *next;
+};
+
+struct job *job_new(int type, const char *src, const char *dst);
+int job_add(struct job *job, const char *name);
+int job_submit(struct job *job);
+void job_discard(struct job *job);
+int job_fd(void);
+struct job *job_ended(void);
+int job_active(void);
+int job_status(char *out, size_t length);
+int job_list(char *out, size_t length);
+int job_control(int id, int action);
+int job_resume(void);
+void job_free(void);
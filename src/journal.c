@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "arena.h"
+#include "view.h"
+#include "trash.h"
+#include "util.h"
+#include "strlcpy.h"
+#include "journal.h"
+
+#define JOURNAL_DIR ".mz"
+#define JOURNAL_MAGIC "mz-journal 1"
+#define JOURNAL_READ 65536
+#define JOURNAL_TRIES 64 /* names tried before giving up */
+
+/* directory of the journals, created if needed */
+static int journal_dir(void) {
+	char path[1024];
+	int home, dir;
+	if (gethome(V(path)) == -1) return -1;
+	home = open(path, O_DIRECTORY);
+	if (home < 0) return -1;
+	dir = openat(home, JOURNAL_DIR, O_DIRECTORY);
+	if (dir < 0 && errno == ENOENT && !mkdirat(home, JOURNAL_DIR, 0700))
+		dir = openat(home, JOURNAL_DIR, O_DIRECTORY);
+	close(home);
+	return dir;
+}
+
+/* records are appended by a single write to not be mixed between threads */
+static int journal_write(struct journal *journal, const char *data,
+			size_t length) {
+	ssize_t n = write(journal->fd, data, length);
+	if (n == (ssize_t)length) return 0;
+	if (n >= 0) errno = ENOSPC;
+	return -1;
+}
+
+/* Start the journal of the job id, the header is a list of strings ending
+ * with an empty one. */
+int journal_create(struct journal *journal, int id,
+			const char *header, size_t length) {
+
+	unsigned long try;
+	int dir;
+
+	memset(journal, 0, sizeof(*journal));
+	journal->fd = -1;
+	dir = journal_dir();
+	if (dir < 0) return -1;
+	/* the journal of an interrupted copy may have the same pid */
+	for (try = 0; journal->fd < 0 && try < JOURNAL_TRIES; try++) {
+		snprintf(V(journal->name), "%ld-%lu-%d-%lu", (long)getpid(),
+				(unsigned long)time(NULL), id, try);
+		journal->fd = openat(dir, journal->name,
+				O_WRONLY|O_CREAT|O_EXCL|O_APPEND|O_CLOEXEC,
+				0600);
+		if (journal->fd < 0 && errno != EEXIST) break;
+	}
+	close(dir);
+	if (journal->fd < 0) return -1;
+	if (flock(journal->fd, LOCK_EX | LOCK_NB) ||
+			journal_write(journal, V(JOURNAL_MAGIC)) ||
+			journal_write(journal, header, length)) {
+		journal_close(journal, 0);
+		return -1;
+	}
+	return 0;
+}
+
+/* the file at path, relative to the destination, was copied */
+int journal_file(struct journal *journal, const char *path) {
+	return journal_files(journal, &path, 1);
+}
+
+int journal_files(struct journal *journal, const char **paths, size_t count) {
+
+	char buf[JOURNAL_READ];
+	size_t i, length, len;
+
+	if (!journal || journal->fd < 0) return 0;
+	length = 0;
+	for (i = 0; i < count; i++) {
+		len = strlen(paths[i]) + 1;
+		if (length + len + 2 > sizeof(buf)) {
+			if (journal_write(journal, buf, length)) return -1;
+			length = 0;
+		}
+		if (len + 2 > sizeof(buf)) continue;
+		memcpy(&buf[length], "F", 2);
+		memcpy(&buf[length + 2], paths[i], len);
+		length += len + 2;
+	}
+	return journal_write(journal, buf, length);
+}
+
+/* the bytes from offset to offset + length of the file at path were copied
+ * and written to the disk */
+int journal_range(struct journal *journal, const char *path,
+			off_t offset, off_t length) {
+	char buf[PATH_MAX + 64];
+	int len;
+	if (!journal || journal->fd < 0) return 0;
+	len = snprintf(V(buf), "R%c%.0f%c%.0f%c%s", 0, (double)offset, 0,
+			(double)length, 0, path);
+	if (len >= (int)sizeof(buf)) return 0;
+	return journal_write(journal, buf, len + 1);
+}
+
+static int journal_compare_files(const void *a, const void *b) {
+	return strcmp(*(const char**)a, *(const char**)b);
+}
+
+static int journal_compare_ranges(const void *a, const void *b) {
+	const struct journal_range *x = a, *y = b;
+	int ret = strcmp(x->path, y->path);
+	if (ret) return ret;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/* the file at path was copied before the copy was interrupted */
+int journal_finished(struct journal *journal, const char *path) {
+	if (!journal || !journal->files_length) return 0;
+	return bsearch(&path, journal->files, journal->files_length,
+			sizeof(const char*), journal_compare_files) != NULL;
+}
+
+/* the range of the file at path was copied before the interruption */
+int journal_copied(struct journal *journal, const char *path,
+			off_t offset, off_t length) {
+	struct journal_range key, *range;
+	if (!journal || !journal->ranges_length) return 0;
+	key.path = path;
+	key.offset = offset;
+	range = bsearch(&key, journal->ranges, journal->ranges_length,
+			sizeof(key), journal_compare_ranges);
+	return range && range->length == length;
+}
+
+/* some ranges of the file at path were copied */
+int journal_partial(struct journal *journal, const char *path) {
+	size_t low, high;
+	if (!journal || !journal->ranges_length) return 0;
+	low = 0;
+	high = journal->ranges_length;
+	while (low < high) {
+		size_t middle = (low + high) / 2;
+		int ret = strcmp(journal->ranges[middle].path, path);
+		if (!ret) return 1;
+		if (ret < 0) low = middle + 1;
+		else high = middle;
+	}
+	return 0;
+}
+
+/* Stop appending to the journal and remove it unless it should be kept to
+ * resume the copy later. */
+void journal_close(struct journal *journal, int keep) {
+	if (journal->fd > -1) {
+		if (!keep) {
+			int dir = journal_dir();
+			if (dir > -1) {
+				unlinkat(dir, journal->name, 0);
+				close(dir);
+			}
+		}
+		close(journal->fd);
+	}
+	journal->fd = -1;
+	arena_free(&journal->data);
+	free(journal->files);
+	free(journal->ranges);
+	journal->files = NULL;
+	journal->ranges = NULL;
+	journal->files_length = journal->ranges_length = 0;
+}
+
+/* locked journal named name if it was interrupted, -1 otherwise */
+static int journal_lock(int dir, const char *name) {
+	int fd;
+	if (*name == '.') return -1;
+	fd = openat(dir, name, O_RDWR|O_APPEND|O_CLOEXEC);
+	if (fd < 0) return -1;
+	if (!flock(fd, LOCK_EX | LOCK_NB)) return fd;
+	close(fd);
+	return -1;
+}
+
+/* Next record after the one at ptr, its type is F for a copied file and
+ * R for a range. Returns NULL if it doesn't end before end. */
+static char *journal_next(char *ptr, char *end, int *type) {
+	int strings;
+	*type = *ptr;
+	if (!strcmp(ptr, "F")) strings = 2;
+	else if (!strcmp(ptr, "R")) strings = 4;
+	else return NULL;
+	while (strings--) {
+		char *nul = memchr(ptr, '\0', end - ptr);
+		if (!nul) return NULL;
+		ptr = nul + 1;
+	}
+	return ptr;
+}
+
+/* read the journal and index its records, a record cut by the interruption
+ * is ignored */
+static int journal_load(struct journal *journal) {
+
+	size_t files, ranges;
+	char *ptr, *end, *next, *records;
+	int type;
+
+	for (;;) {
+		char *buf = arena_reserve(&journal->data, JOURNAL_READ);
+		ssize_t n;
+		if (!buf) return -1;
+		n = read(journal->fd, buf, JOURNAL_READ);
+		if (n < 0) return -1;
+		if (!n) break;
+		journal->data.length += n;
+	}
+	ptr = journal->data.data;
+	end = ptr + journal->data.length;
+	if (journal->data.length < sizeof(JOURNAL_MAGIC) ||
+			memcmp(ptr, V(JOURNAL_MAGIC))) {
+		errno = EINVAL;
+		return -1;
+	}
+	ptr += sizeof(JOURNAL_MAGIC);
+
+	/* the header ends with an empty string */
+	journal->header = ptr;
+	while (ptr < end && *ptr) {
+		ptr = memchr(ptr, '\0', end - ptr);
+		if (!ptr) break;
+		ptr++;
+	}
+	if (!ptr || ptr >= end) {
+		errno = EINVAL;
+		return -1;
+	}
+	records = ++ptr;
+
+	/* count the records first to allocate the indexes at once */
+	files = ranges = 0;
+	for (ptr = records; ptr < end; ptr = next) {
+		next = journal_next(ptr, end, &type);
+		if (!next) break;
+		if (type == 'F') files++;
+		else ranges++;
+	}
+	end = ptr;
+	journal->files = malloc((files ? files : 1) * sizeof(const char*));
+	journal->ranges = malloc((ranges ? ranges : 1) *
+				sizeof(struct journal_range));
+	if (!journal->files || !journal->ranges) return -1;
+
+	journal->files_length = journal->ranges_length = 0;
+	for (ptr = records; ptr < end; ptr = next) {
+		next = journal_next(ptr, end, &type);
+		ptr += 2;
+		if (type == 'F') {
+			journal->files[journal->files_length++] = ptr;
+		} else {
+			struct journal_range *range;
+			range = &journal->ranges[journal->ranges_length++];
+			range->offset = strtod(ptr, NULL);
+			ptr += strlen(ptr) + 1;
+			range->length = strtod(ptr, NULL);
+			ptr += strlen(ptr) + 1;
+			range->path = ptr;
+		}
+	}
+	qsort(journal->files, journal->files_length, sizeof(const char*),
+		journal_compare_files);
+	qsort(journal->ranges, journal->ranges_length,
+		sizeof(struct journal_range), journal_compare_ranges);
+	journal->resumed = 1;
+	return 0;
+}
+
+/* number of copies that were interrupted */
+size_t journal_count(void) {
+	struct dirent *entry;
+	size_t count;
+	DIR *dir;
+	int fd;
+	fd = journal_dir();
+	if (fd < 0) return 0;
+	dir = fdopendir(fd);
+	if (!dir) {
+		close(fd);
+		return 0;
+	}
+	count = 0;
+	while ((entry = readdir(dir))) {
+		int journal = journal_lock(fd, entry->d_name);
+		if (journal < 0) continue;
+		close(journal);
+		count++;
+	}
+	closedir(dir);
+	return count;
+}
+
+/* Load up to length interrupted journals, they stay locked until closed.
+ * Returns the number of journals loaded. */
+size_t journal_interrupted(struct journal **journals, size_t length) {
+
+	struct dirent *entry;
+	size_t count;
+	DIR *dir;
+	int fd;
+
+	fd = journal_dir();
+	if (fd < 0) return 0;
+	dir = fdopendir(fd);
+	if (!dir) {
+		close(fd);
+		return 0;
+	}
+	count = 0;
+	while (count < length && (entry = readdir(dir))) {
+		struct journal *journal;
+		int locked = journal_lock(fd, entry->d_name);
+		if (locked < 0) continue;
+		journal = calloc(1, sizeof(struct journal));
+		if (!journal) {
+			close(locked);
+			break;
+		}
+		journal->fd = locked;
+		STRCPY(journal->name, entry->d_name);
+		if (journal_load(journal)) {
+			/* not a journal that can be resumed */
+			journal_close(journal, 0);
+			free(journal);
+			continue;
+		}
+		journals[count++] = journal;
+	}
+	closedir(dir);
+	return count;
+}
+
+/* remove the journals of the interrupted copies */
+int journal_discard(void) {
+	struct dirent *entry;
+	DIR *dir;
+	int fd;
+	fd = journal_dir();
+	if (fd < 0) return -1;
+	dir = fdopendir(fd);
+	if (!dir) {
+		close(fd);
+		return -1;
+	}
+	while ((entry = readdir(dir))) {
+		int journal = journal_lock(fd, entry->d_name);
+		if (journal < 0) continue;
+		unlinkat(fd, entry->d_name, 0);
+		close(journal);
+	}
+	closedir(dir);
+	return 0;
+}
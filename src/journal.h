@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+/* Journal of a copy job in ~/.mz, the files and the ranges of large files
+ * are recorded once copied so that the job can be resumed if mz is killed.
+ * It starts with a header describing the job. A journal is locked while
+ * it is used, the ones left unlocked were interrupted. */
+struct journal_range {
+	const char *path;
+	off_t offset;
+	off_t length;
+};
+
+struct journal {
+	int fd;
+	char name[64]; /* in the journals directory */
+	int resumed; /* loaded from an interrupted copy */
+	struct arena data; /* content of the journal when resumed */
+	const char *header; /* strings ending with an empty one */
+	const char **files; /* paths of the copied files, sorted */
+	size_t files_length;
+	struct journal_range *ranges; /* sorted by path and offset */
+	size_t ranges_length;
+};
+
+int journal_create(struct journal *journal, int id,
+			const char *header, size_t length);
+int journal_file(struct journal *journal, const char *path);
+int journal_files(struct journal *journal, const char **paths, size_t count);
+int journal_range(struct journal *journal, const char *path,
+			off_t offset, off_t length);
+int journal_finished(struct journal *journal, const char *path);
+int journal_copied(struct journal *journal, const char *path,
+			off_t offset, off_t length);
+int journal_partial(struct journal *journal, const char *path);
+void journal_close(struct journal *journal, int keep);
+size_t journal_count(void);
+size_t journal_interrupted(struct journal **journals, size_t length);
+int journal_discard(void);
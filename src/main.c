@@ -20,7 +20,9 @@
 #include <errno.h>
 #include <string.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include "util.h"
+#include "arena.h"
 #include "client.h"
 #include "view.h"
 #include "file.h"
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "config.h"
+#include "ring.h"
+#include "meta.h"
+
+#define META_THREADS 16 /* most threads, the stats may wait on the disk */
+#define META_PARALLEL 64 /* minimum number of stats per thread */
+
+#if defined(HAS_IO_URING) && defined(STATX_BASIC_STATS)
+#define HAS_META_RING
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+
+#define META_RING 256 /* number of stats in flight */
+
+static struct ring ring;
+static struct statx *buffers; /* kept as long as the ring can write them */
+
+static void meta_convert(struct stat *st, struct statx *stx) {
+	memset(st, 0, sizeof(*st));
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	st->st_ino = stx->stx_ino;
+	st->st_mode = stx->stx_mode;
+	st->st_nlink = stx->stx_nlink;
+	st->st_uid = stx->stx_uid;
+	st->st_gid = stx->stx_gid;
+	st->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+	st->st_size = stx->stx_size;
+	st->st_blksize = stx->stx_blksize;
+	st->st_blocks = stx->stx_blocks;
+	st->st_atime = stx->stx_atime.tv_sec;
+	st->st_mtime = stx->stx_mtime.tv_sec;
+	st->st_ctime = stx->stx_ctime.tv_sec;
+}
+
+/* Submit the stats by waves filling the ring and wait for them. Returns
+ * the number of stats done, the others are left to the threads. */
+static size_t meta_ring(int fd, struct meta *metas, size_t count, int flags) {
+
+	size_t done;
+
+	if (ring_init(&ring, META_RING)) return 0;
+	if (!buffers) buffers = malloc(ring.entries * sizeof(struct statx));
+	if (!buffers) return 0;
+
+	done = 0;
+	while (done < count) {
+		unsigned int i, n, submit, reaped;
+
+		n = count - done > ring.entries ?
+			ring.entries : count - done;
+		for (i = 0; i < n; i++) {
+			struct io_uring_sqe *sqe = ring_queue(&ring);
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = fd;
+			sqe->addr = (unsigned long)metas[done + i].name;
+			sqe->len = STATX_BASIC_STATS;
+			sqe->off = (unsigned long)&buffers[i];
+			sqe->statx_flags = flags;
+			sqe->user_data = i;
+		}
+
+		submit = n;
+		reaped = 0;
+		while (reaped < n) {
+			struct io_uring_cqe *cqe;
+			long ret = ring_enter(&ring, submit, 1);
+			if (ret < 0) {
+				/* the buffers may still be written,
+				 * they are never freed */
+				ring.fd = -1;
+				return done;
+			}
+			submit -= ret;
+			while ((cqe = ring_peek(&ring))) {
+				struct meta *meta;
+				meta = &metas[done + cqe->user_data];
+				meta->error = cqe->res < 0 ? -cqe->res : 0;
+				if (!cqe->res)
+					meta_convert(&meta->st,
+						&buffers[cqe->user_data]);
+				ring_seen(&ring);
+				reaped++;
+			}
+		}
+
+		/* statx is not supported by the ring of this kernel */
+		for (i = 0; i < n; i++) {
+			if (metas[done + i].error != EINVAL) continue;
+			ring_close(&ring);
+			return done;
+		}
+		done += n;
+	}
+	return done;
+}
+#endif
+
+struct meta_job {
+	int fd;
+	int flags;
+	struct meta *metas;
+	size_t count;
+};
+
+static void *meta_thread(void *arg) {
+	struct meta_job *job = arg;
+	size_t i;
+	for (i = 0; i < job->count; i++) {
+		struct meta *meta = &job->metas[i];
+		meta->error = fstatat(job->fd, meta->name, &meta->st,
+					job->flags) ? errno : 0;
+	}
+	return NULL;
+}
+
+static void meta_threads(int fd, struct meta *metas, size_t count,
+			int flags, size_t max) {
+
+	pthread_t threads[META_THREADS];
+	struct meta_job jobs[META_THREADS];
+	size_t n, i, started;
+
+	n = count / META_PARALLEL;
+	if (n > max) n = max;
+	if (n < 1) n = 1;
+
+	for (i = 0; i < n; i++) {
+		jobs[i].fd = fd;
+		jobs[i].flags = flags;
+		jobs[i].metas = &metas[count * i / n];
+		jobs[i].count = count * (i + 1) / n - count * i / n;
+	}
+	/* the first slice is done by the calling thread */
+	for (started = 1; started < n; started++) {
+		if (pthread_create(&threads[started], NULL, meta_thread,
+					&jobs[started]))
+			break;
+	}
+	for (i = started; i < n; i++) meta_thread(&jobs[i]);
+	meta_thread(&jobs[0]);
+	for (i = 1; i < started; i++) pthread_join(threads[i], NULL);
+}
+
+static long meta_cpus(void) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : n;
+}
+
+/* Stat count entries of the directory fd, flags are the ones of fstatat.
+ * Must only be called from the main thread. */
+void meta_stat(int fd, struct meta *metas, size_t count, int flags) {
+
+	static long threads, uring;
+	size_t done;
+
+	/* a thread per cpu unless MZ_STAT_THREADS is set, the stats are done
+	 * one by one if it is 1. The ring is slower than the loop on a single
+	 * cpu and only used if MZ_STAT_RING is 1. */
+	if (!threads) {
+		threads = config_number("MZ_STAT_THREADS", meta_cpus());
+		if (threads < 1) threads = 1;
+		if (threads > META_THREADS) threads = META_THREADS;
+		uring = config_number("MZ_STAT_RING", 0);
+	}
+
+	done = 0;
+#ifdef HAS_META_RING
+	if (uring && count > 1)
+		done = meta_ring(fd, metas, count, flags);
+#else
+	(void)uring;
+#endif
+	if (done < count)
+		meta_threads(fd, &metas[done], count - done, flags, threads);
+}
+
+void meta_free(void) {
+#ifdef HAS_META_RING
+	if (ring.fd > 0) ring_close(&ring);
+	free(buffers);
+	buffers = NULL;
+#endif
+}
@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fts.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "arena.h"
+#include "view.h"
+#include "file.h"
+#include "copy.h"
+#include "config.h"
+#include "purge.h"
+
+#define PURGE_THREADS 4 /* default number of threads unlinking files */
+#define PURGE_THREADS_MAX 64
+#define PURGE_BATCH 65536 /* bytes of names given at once to a thread */
+#define PURGE_QUEUE 4 /* batches waiting for each thread */
+
+/* a directory followed by names of files in it */
+struct batch {
+	struct batch *next;
+	size_t length;
+	size_t count;
+	char data[PURGE_BATCH];
+};
+
+struct purge {
+	struct batch *first;
+	struct batch *last;
+	size_t queued;
+	size_t limit; /* of the queued batches */
+	int walked; /* every file was queued */
+	int cancelled;
+	int error; /* errno of the first failure */
+	int idle;
+	struct copy *copy;
+	pthread_mutex_t lock;
+	pthread_cond_t ready; /* a batch was queued or the walk ended */
+	pthread_cond_t room; /* a batch was taken */
+};
+
+/* Only use the disk when no other process needs it. Returns the previous
+ * I/O priority of the calling thread, -1 if it didn't change. */
+static int purge_idle(int idle) {
+#if defined(__linux__) && defined(SYS_ioprio_set) && defined(SYS_ioprio_get)
+	/* IOPRIO_WHO_PROCESS of the calling thread, IOPRIO_CLASS_IDLE */
+	int priority;
+	if (!idle) return -1;
+	priority = syscall(SYS_ioprio_get, 1, 0);
+	if (priority < 0 || syscall(SYS_ioprio_set, 1, 0, 3 << 13))
+		return -1;
+	return priority;
+#else
+	(void)idle;
+	return -1;
+#endif
+}
+
+/* give back its I/O priority to the calling thread */
+static void purge_restore(int priority) {
+#if defined(__linux__) && defined(SYS_ioprio_set) && defined(SYS_ioprio_get)
+	if (priority >= 0) syscall(SYS_ioprio_set, 1, 0, priority);
+#else
+	(void)priority;
+#endif
+}
+
+static void purge_error(struct purge *purge, int error) {
+	if (error == ENOENT) return; /* removed by someone else */
+	pthread_mutex_lock(&purge->lock);
+	if (!purge->error) purge->error = error;
+	pthread_mutex_unlock(&purge->lock);
+}
+
+/* unlink the files of a batch relatively to their directory */
+static void purge_batch(struct purge *purge, struct batch *batch) {
+
+	const char *name;
+	size_t i, files, bytes;
+	int dir;
+
+	dir = open(batch->data, O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+	if (dir < 0) {
+		purge_error(purge, errno);
+		return;
+	}
+	files = bytes = 0;
+	name = batch->data + strlen(batch->data) + 1;
+	for (i = 0; i < batch->count; i++, name += strlen(name) + 1) {
+		struct stat st;
+		if (fstatat(dir, name, &st, AT_SYMLINK_NOFOLLOW) ||
+				unlinkat(dir, name, 0)) {
+			purge_error(purge, errno);
+			continue;
+		}
+		files++;
+		/* the blocks of the files with other links are not freed */
+		if (st.st_nlink < 2) bytes += st.st_blocks * 512;
+	}
+	close(dir);
+	copy_removed(purge->copy, files, bytes);
+}
+
+static void *purge_worker(void *arg) {
+
+	struct purge *purge = arg;
+
+	purge_idle(purge->idle);
+	for (;;) {
+		struct batch *batch;
+		int cancelled;
+
+		pthread_mutex_lock(&purge->lock);
+		while (!purge->first && !purge->walked)
+			pthread_cond_wait(&purge->ready, &purge->lock);
+		batch = purge->first;
+		if (batch) {
+			purge->first = batch->next;
+			if (!purge->first) purge->last = NULL;
+			purge->queued--;
+			pthread_cond_signal(&purge->room);
+		}
+		pthread_mutex_unlock(&purge->lock);
+		if (!batch) break;
+
+		/* the batches left are dropped once cancelled */
+		cancelled = copy_wait(purge->copy);
+		pthread_mutex_lock(&purge->lock);
+		if (cancelled) {
+			if (!purge->error) purge->error = errno;
+			purge->cancelled = 1;
+		}
+		cancelled = purge->cancelled;
+		pthread_mutex_unlock(&purge->lock);
+		if (!cancelled) purge_batch(purge, batch);
+		free(batch);
+	}
+	return NULL;
+}
+
+/* hand a batch to the threads, waiting for room in the queue */
+static int purge_queue(struct purge *purge, struct batch *batch) {
+	int cancelled;
+	pthread_mutex_lock(&purge->lock);
+	while (purge->queued >= purge->limit && !purge->cancelled)
+		pthread_cond_wait(&purge->room, &purge->lock);
+	cancelled = purge->cancelled;
+	if (!cancelled) {
+		batch->next = NULL;
+		if (purge->last) purge->last->next = batch;
+		else purge->first = batch;
+		purge->last = batch;
+		purge->queued++;
+		pthread_cond_signal(&purge->ready);
+	}
+	pthread_mutex_unlock(&purge->lock);
+	if (cancelled) free(batch);
+	return -cancelled;
+}
+
+/* add the file of ent to the batch of its directory */
+static int purge_add(struct purge *purge, struct batch **batch,
+			const FTSENT *ent) {
+
+	const FTSENT *parent = ent->fts_parent;
+	size_t length = ent->fts_namelen + 1;
+
+	/* the path of the parent is the start of the one of ent */
+	if (*batch && (memcmp((*batch)->data, parent->fts_path,
+				parent->fts_pathlen) ||
+			(*batch)->data[parent->fts_pathlen] ||
+			(*batch)->length + length > PURGE_BATCH)) {
+		if (purge_queue(purge, *batch)) {
+			*batch = NULL;
+			return -1;
+		}
+		*batch = NULL;
+	}
+	if (!*batch) {
+		size_t dir = parent->fts_pathlen + 1;
+		if (dir + length > PURGE_BATCH) {
+			purge_error(purge, ENAMETOOLONG);
+			return 0;
+		}
+		*batch = malloc(sizeof(struct batch));
+		if (!*batch) {
+			purge_error(purge, errno);
+			return -1;
+		}
+		(*batch)->count = 0;
+		memcpy((*batch)->data, parent->fts_path, dir - 1);
+		(*batch)->data[dir - 1] = '\0';
+		(*batch)->length = dir;
+	}
+	memcpy(&(*batch)->data[(*batch)->length], ent->fts_name, length);
+	(*batch)->length += length;
+	(*batch)->count++;
+	return 0;
+}
+
+int purge_tree(const char *path, int idle, struct copy *copy) {
+
+	pthread_t threads[PURGE_THREADS_MAX];
+	struct purge purge;
+	struct batch *batch;
+	struct arena dirs;
+	char *paths[2];
+	size_t i, started, count, offset;
+	FTS *fts;
+	FTSENT *ent;
+	int priority;
+
+	memset(&purge, 0, sizeof(purge));
+	memset(&dirs, 0, sizeof(dirs));
+	purge.idle = idle;
+	purge.copy = copy;
+	count = config_number("MZ_PURGE_THREADS", PURGE_THREADS);
+	if (count < 1) count = 1;
+	if (count > PURGE_THREADS_MAX) count = PURGE_THREADS_MAX;
+	purge.limit = count * PURGE_QUEUE;
+
+	paths[0] = (char*)path;
+	paths[1] = NULL;
+	/* the types come from the directories, the threads stat the files */
+	fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR | FTS_NOSTAT, NULL);
+	if (!fts) return errno == ENOENT ? 0 : -1;
+	purge.error = ENOMEM;
+	if (pthread_mutex_init(&purge.lock, NULL)) goto fail;
+	if (pthread_cond_init(&purge.ready, NULL)) goto mutex;
+	if (pthread_cond_init(&purge.room, NULL)) goto ready;
+	for (started = 0; started < count; started++) {
+		if (pthread_create(&threads[started], NULL, purge_worker,
+					&purge))
+			break;
+	}
+	if (!started) {
+		purge.error = EAGAIN;
+		goto room;
+	}
+	purge.error = 0;
+	/* the calling thread goes back to its priority for the next jobs */
+	priority = purge_idle(idle);
+
+	batch = NULL;
+	while ((ent = fts_read(fts))) {
+		switch (ent->fts_info) {
+		case FTS_D:
+			continue;
+		case FTS_DP:
+			/* removed once its files are, after its subdirectories */
+			if (arena_add(&dirs, ent->fts_path, ent->fts_pathlen) ==
+					ARENA_ERR)
+				purge_error(&purge, errno);
+			continue;
+		case FTS_DNR:
+		case FTS_ERR:
+		case FTS_NS:
+			purge_error(&purge, ent->fts_errno);
+			continue;
+		}
+		if (!ent->fts_level) {
+			if (unlink(ent->fts_path)) purge_error(&purge, errno);
+			else copy_removed(copy, 1, 0);
+			continue;
+		}
+		if (purge_add(&purge, &batch, ent)) break;
+	}
+	if (batch) purge_queue(&purge, batch);
+
+	pthread_mutex_lock(&purge.lock);
+	purge.walked = 1;
+	pthread_cond_broadcast(&purge.ready);
+	pthread_mutex_unlock(&purge.lock);
+	for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+	for (offset = 0; !purge.cancelled && offset < dirs.length;
+			offset += strlen(&dirs.data[offset]) + 1) {
+		if (rmdir(&dirs.data[offset])) purge_error(&purge, errno);
+	}
+	purge_restore(priority);
+room:
+	pthread_cond_destroy(&purge.room);
+ready:
+	pthread_cond_destroy(&purge.ready);
+mutex:
+	pthread_mutex_destroy(&purge.lock);
+fail:
+	fts_close(fts);
+	arena_free(&dirs);
+	if (!purge.error) return 0;
+	errno = purge.error;
+	return -1;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "ring.h"
+#ifdef HAS_IO_URING
+#include <linux/io_uring.h>
+
+void ring_close(struct ring *ring) {
+	if (ring->sqes)
+		munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+	if (ring->cq && ring->cq != ring->sq) munmap(ring->cq, ring->cq_size);
+	if (ring->sq) munmap(ring->sq, ring->sq_size);
+	if (ring->fd > 0) close(ring->fd);
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+/* Map a ring of at least the given number of entries. Returns -1 if
+ * io_uring is not available, the ring is then left marked as such. */
+int ring_init(struct ring *ring, unsigned int entries) {
+
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	if (ring->fd) return ring->fd < 0 ? -1 : 0;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(SYS_io_uring_setup, entries, &p);
+	if (ring->fd < 0) {
+		ring->fd = -1;
+		return -1;
+	}
+	ring->entries = p.sq_entries;
+
+	ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+		ring->cq_size = ring->sq_size;
+	}
+	sq = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			ring->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED) goto fail;
+	ring->sq = sq;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, ring->fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED) goto fail;
+	}
+	ring->cq = cq;
+	ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+			PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd,
+			IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto fail;
+	}
+
+	ring->sq_tail = (unsigned int*)(sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned int*)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int*)(sq + p.sq_off.array);
+	ring->cq_head = (unsigned int*)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned int*)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned int*)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+	ring->tail = *ring->sq_tail;
+	return 0;
+fail:
+	ring_close(ring);
+	return -1;
+}
+
+/* Register a buffer for the fixed reads and writes, it is then referred to
+ * by the index 0. Fails if it exceeds the locked memory limit. */
+int ring_buffers(struct ring *ring, void *data, size_t length) {
+	struct iovec iov;
+	iov.iov_base = data;
+	iov.iov_len = length;
+	return syscall(SYS_io_uring_register, ring->fd,
+			IORING_REGISTER_BUFFERS, &iov, 1) ? -1 : 0;
+}
+
+/* Next free entry, cleared, submitted by the next ring_enter. The caller
+ * must not queue more entries than the ring has before submitting. */
+struct io_uring_sqe *ring_queue(struct ring *ring) {
+	unsigned int slot = ring->tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[slot];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[slot] = slot;
+	ring->tail++;
+	return sqe;
+}
+
+/* Submit the queued entries and wait for at least wait completions.
+ * Returns the number of entries submitted or -1. */
+long ring_enter(struct ring *ring, unsigned int submit, unsigned int wait) {
+	long ret;
+	/* the entries are visible to the kernel before the new tail */
+	__atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+	do {
+		ret = syscall(SYS_io_uring_enter, ring->fd, submit, wait,
+				wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+/* oldest completion not seen yet, NULL if there is none */
+struct io_uring_cqe *ring_peek(struct ring *ring) {
+	unsigned int head = *ring->cq_head;
+	/* the completions up to the tail are written before it is read */
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+/* release the completion returned by ring_peek */
+void ring_seen(struct ring *ring) {
+	/* the completion is read before the kernel can reuse its slot */
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+#else
+typedef int ring_unavailable; /* a translation unit can't be empty */
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+/* Minimal io_uring without liburing, <sys/syscall.h> must be included first
+ * and <linux/io_uring.h> before using the entries. Only one thread at a
+ * time may use a ring. */
+#if defined(__linux__) && defined(SYS_io_uring_setup) && \
+	defined(SYS_io_uring_enter) && !defined(NO_IO_URING)
+#define HAS_IO_URING
+
+struct ring {
+	int fd; /* 0 if not initialized, -1 if unavailable */
+	unsigned int entries;
+	unsigned int tail; /* of the entries queued but not yet submitted */
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq;
+	void *cq;
+	size_t sq_size;
+	size_t cq_size;
+};
+
+int ring_init(struct ring *ring, unsigned int entries);
+int ring_buffers(struct ring *ring, void *data, size_t length);
+struct io_uring_sqe *ring_queue(struct ring *ring);
+long ring_enter(struct ring *ring, unsigned int submit, unsigned int wait);
+struct io_uring_cqe *ring_peek(struct ring *ring);
+void ring_seen(struct ring *ring);
+void ring_close(struct ring *ring);
+#endif
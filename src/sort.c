@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2025 RMF <rawmonk@rmf-dev.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _BSD_SOURCE
+#endif
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include "termbox.h"
+#include "arena.h"
+#include "view.h"
+#include "file.h"
+#include "util.h"
+#include "sort.h"
+
+/* the collation key of an entry is stored right after its name */
+#define KEY(X, E) (&(X)[(E)->name + (E)->length + 1])
+/* listings above this size are sorted by several threads */
+#define SORT_PARALLEL 65536
+#define SORT_THREADS 8
+
+/* Append the collation key of name to the arena and return its length, the
+ * key must be added right after the name. Whitespaces are skipped and
+ * letters are lowercased so that comparing two keys with memcmp gives the
+ * same order as comparing the names character by character. */
+int sort_key(struct arena *names, const char *name, size_t length) {
+
+	char *key;
+	size_t i, j;
+
+	key = arena_reserve(names, length);
+	if (!key) return -1;
+
+	/* ascii names are copied byte per byte */
+	for (i = j = 0; i < length && !(name[i] & 0x80); i++) {
+		if (name[i] == ' ' || name[i] == '\t') continue;
+		key[j++] = name[i] >= 'A' && name[i] <= 'Z' ?
+				name[i] - 'A' + 'a' : name[i];
+	}
+
+	/* utf-8 names are decoded and encoded back, the encoding preserves
+	 * the order of the code points */
+	while (i < length) {
+		uint32_t c;
+		int len = tb_utf8_char_length(name[i]);
+		if (i + len > length) break;
+		i += tb_utf8_char_to_unicode(&c, &name[i]);
+		if (c == ' ' || c == '\t') continue;
+		if (c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+		j += tb_utf8_unicode_to_char(&key[j], c);
+	}
+
+	key[j] = '\0';
+	names->length += j + 1;
+	return j;
+}
+
+/* names of the entries being sorted, qsort does not take a context */
+static const char *sort_names;
+
+static int sort_compare_name(const struct entry *first,
+				const struct entry *second) {
+	size_t length;
+	int ret;
+
+	length = first->key_length < second->key_length ?
+			first->key_length : second->key_length;
+	ret = memcmp(KEY(sort_names, first), KEY(sort_names, second), length);
+	if (ret) return ret;
+	if (first->key_length != second->key_length)
+		return first->key_length < second->key_length ? -1 : 1;
+	/* equal keys, keep the order deterministic */
+	return strcmp(&sort_names[first->name], &sort_names[second->name]);
+}
+
+static int sort_compare(const void *a, const void *b) {
+	const struct entry *first = a, *second = b;
+	int ret = sort_compare_name(first, second);
+	if (ret) return ret;
+	/* same names can only be found in the trash */
+	return first->name < second->name ? -1 : first->name > second->name;
+}
+
+static int sort_compare_type(const void *a, const void *b) {
+	const struct entry *first = a, *second = b;
+	if ((first->type == DT_DIR) != (second->type == DT_DIR))
+		return first->type == DT_DIR ? -1 : 1;
+	return sort_compare(a, b);
+}
+
+static void merge(struct entry *out, struct entry *left, size_t llen,
+			struct entry *right, size_t rlen,
+			int (*compare)(const void *, const void *)) {
+	while (llen && rlen) {
+		if (compare(right, left) < 0) {
+			*out++ = *right++;
+			rlen--;
+		} else {
+			*out++ = *left++;
+			llen--;
+		}
+	}
+	memcpy(out, left, llen * sizeof(struct entry));
+	memcpy(out + llen, right, rlen * sizeof(struct entry));
+}
+
+struct sort_job {
+	struct entry *entries;
+	struct entry *tmp;
+	size_t length;
+	int threads;
+};
+
+/* merge sort splitting the work between threads until the parts are
+ * small enough to be sorted with qsort */
+static void *sort_thread(void *arg) {
+
+	struct sort_job *job = arg, left, right;
+	pthread_t thread;
+
+	if (job->threads < 2 || job->length < SORT_PARALLEL) {
+		qsort(job->entries, job->length, sizeof(struct entry),
+				sort_compare);
+		return NULL;
+	}
+
+	left.entries = job->entries;
+	left.tmp = job->tmp;
+	left.length = job->length / 2;
+	left.threads = job->threads / 2;
+	right.entries = job->entries + left.length;
+	right.tmp = job->tmp + left.length;
+	right.length = job->length - left.length;
+	right.threads = job->threads - left.threads;
+
+	if (pthread_create(&thread, NULL, sort_thread, &left)) {
+		sort_thread(&left);
+		sort_thread(&right);
+	} else {
+		sort_thread(&right);
+		pthread_join(thread, NULL);
+	}
+
+	merge(job->tmp, left.entries, left.length,
+			right.entries, right.length, sort_compare);
+	memcpy(job->entries, job->tmp, job->length * sizeof(struct entry));
+	return NULL;
+}
+
+static void sort_range(struct entry *entries, struct entry *tmp,
+			size_t length, int threads) {
+	struct sort_job job;
+	job.entries = entries;
+	job.tmp = tmp;
+	job.length = length;
+	job.threads = threads;
+	sort_thread(&job);
+}
+
+static int sort_threads(void) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n < 1) return 1;
+	return n > SORT_THREADS ? SORT_THREADS : n;
+}
+
+/* sort directories first then by case and whitespace insensitive names */
+void sort_entries(struct entry *entries, size_t length, struct arena *names) {
+
+	struct entry *tmp;
+	size_t i, dirs, others;
+	int threads;
+
+	sort_names = names->data;
+
+	threads = length < SORT_PARALLEL ? 1 : sort_threads();
+	tmp = threads > 1 ? malloc(length * sizeof(struct entry)) : NULL;
+	if (!tmp) {
+		/* partition in place, the sort makes up for the lost order */
+		for (i = dirs = 0; i < length; i++) {
+			struct entry e;
+			if (entries[i].type != DT_DIR) continue;
+			e = entries[dirs];
+			entries[dirs++] = entries[i];
+			entries[i] = e;
+		}
+		qsort(entries, dirs, sizeof(struct entry), sort_compare);
+		qsort(&entries[dirs], length - dirs, sizeof(struct entry),
+				sort_compare);
+		return;
+	}
+
+	/* stable partition of the directories before the other entries */
+	for (i = dirs = 0; i < length; i++)
+		if (entries[i].type == DT_DIR) dirs++;
+	for (i = others = 0; i < length; i++) {
+		if (entries[i].type == DT_DIR)
+			tmp[i - others] = entries[i];
+		else
+			tmp[dirs + others++] = entries[i];
+	}
+	memcpy(entries, tmp, length * sizeof(struct entry));
+
+	sort_range(entries, tmp, dirs, threads);
+	sort_range(&entries[dirs], &tmp[dirs], length - dirs, threads);
+	free(tmp);
+}
+
+/* sort the entries after the first sorted ones and merge both parts */
+void sort_merge(struct entry *entries, size_t sorted, size_t length,
+		struct arena *names) {
+
+	struct entry *tmp;
+
+	if (sorted >= length) return;
+	sort_entries(&entries[sorted], length - sorted, names);
+	if (!sorted) return;
+
+	tmp = malloc(length * sizeof(struct entry));
+	if (!tmp) {
+		sort_entries(entries, length, names);
+		return;
+	}
+	merge(tmp, entries, sorted, &entries[sorted], length - sorted,
+			sort_compare_type);
+	memcpy(entries, tmp, length * sizeof(struct entry));
+	free(tmp);
+}
+
+/* Binary search of the entry with the given name among the sorted entries,
+ * dir tells in which part of the listing the entry should be. Returns the
+ * position of the entry or length if it is not found. */
+size_t sort_find(struct entry *entries, size_t length, struct arena *names,
+		const char *name, int dir) {
+
+	struct entry probe;
+	size_t mark, low, high;
+	int ret;
+
+	/* the probe is added at the end of the arena and removed after */
+	mark = names->length;
+	probe.length = strlen(name);
+	probe.name = arena_add(names, name, probe.length);
+	if (probe.name == ARENA_ERR) return length;
+	ret = sort_key(names, name, probe.length);
+	if (ret < 0) {
+		names->length = mark;
+		return length;
+	}
+	probe.key_length = ret;
+	probe.type = dir ? DT_DIR : DT_REG;
+	sort_names = names->data;
+
+	low = 0;
+	high = length;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		struct entry *e = &entries[middle];
+		if ((e->type == DT_DIR) != (probe.type == DT_DIR) ?
+				e->type == DT_DIR :
+				sort_compare_name(e, &probe) < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	names->length = mark;
+
+	if (low < length && (entries[low].type == DT_DIR) == !!dir &&
+			!strcmp(&names->data[entries[low].name], name))
+		return low;
+	return length;
+}
@@ -894,7 +894,7 @@ static int load_builtin_caps(void);
 static const char *get_terminfo_string(int16_t str_offsets_pos,
 			int16_t str_table_pos, int16_t str_table_len,
 			int16_t str_index);
-static int wait_event(struct tb_event *event, int timeout, int fd);
+static int wait_event(struct tb_event *event, int timeout, int fd, int job);
 static int extract_event(struct tb_event *event);
 static int extract_esc(struct tb_event *event);
 static int extract_esc_user(struct tb_event *event, int is_post);
@@ -1217,14 +1217,14 @@ int tb_set_output_mode(int mode) {
 	return TB_ERR;
 }
 
-int tb_peek_event(struct tb_event *event, int timeout_ms, int fd) {
+int tb_peek_event(struct tb_event *event, int timeout_ms, int fd, int job) {
 	if_not_init_return();
-	return wait_event(event, timeout_ms, fd);
+	return wait_event(event, timeout_ms, fd, job);
 }
 
-int tb_poll_event(struct tb_event *event, int fd) {
+int tb_poll_event(struct tb_event *event, int fd, int job) {
 	if_not_init_return();
-	return wait_event(event, -1, fd);
+	return wait_event(event, -1, fd, job);
 }
 
 int tb_get_fds(int *ttyfd, int *resizefd) {
@@ -2048,7 +2048,7 @@ static const char *get_terminfo_string(int16_t str_offsets_pos,
 				(int)*str_offset);
 }
 
-static int wait_event(struct tb_event *event, int timeout, int fd) {
+static int wait_event(struct tb_event *event, int timeout, int fd, int job) {
 	int rv;
 	char buf[TB_OPT_READ_BUF];
 	fd_set fds;
@@ -2062,6 +2062,7 @@ static int wait_event(struct tb_event *event, int timeout, int fd) {
 
 	do {
 		int maxfd, select_rv, tty_has_events, resize_has_events;
+		int job_has_events;
 #ifdef HAS_INOTIFY
 		int inotify_has_events;
 #endif
@@ -2069,10 +2070,13 @@ static int wait_event(struct tb_event *event, int timeout, int fd) {
 		FD_SET(global.rfd, &fds);
 		FD_SET(global.resize_pipefd[0], &fds);
 		if (fd > -1) FD_SET(fd, &fds);
+		if (job > -1) FD_SET(job, &fds);
 
 		maxfd = global.resize_pipefd[0] > global.rfd
 			? global.resize_pipefd[0]
 			: global.rfd;
+		if (fd > maxfd) maxfd = fd;
+		if (job > maxfd) maxfd = job;
 
 		select_rv = select(maxfd + 1, &fds, NULL, NULL,
 					(timeout < 0) ? NULL : &tv);
@@ -2087,6 +2091,7 @@ static int wait_event(struct tb_event *event, int timeout, int fd) {
 
 		tty_has_events = (FD_ISSET(global.rfd, &fds));
 		resize_has_events = (FD_ISSET(global.resize_pipefd[0], &fds));
+		job_has_events = job > -1 ? (FD_ISSET(job, &fds)) : 0;
 #ifdef HAS_INOTIFY
 		inotify_has_events = fd > (-1) ? (FD_ISSET(fd, &fds)) : 0;
 #endif
@@ -2118,22 +2123,19 @@ static int wait_event(struct tb_event *event, int timeout, int fd) {
 		}
 
 #ifdef HAS_INOTIFY
+		/* the events are left to be read by the caller */
 		if (inotify_has_events) {
-			unsigned int avail = 0, i;
-			char buf[64];
-			ioctl(fd, FIONREAD, &avail);
-			for (; avail > 0; avail -= MAX(sizeof(buf), avail)) {
-				i = read(fd, &buf, MAX(sizeof(buf), avail));
-				if (i != avail) {
-					close(fd);
-					return TB_ERR_INOTIFY;
-				}
-			}
 			event->type = TB_EVENT_INOTIFY;
 			return TB_OK;
 		}
 #endif
 
+		/* a background job ended, also left to the caller */
+		if (job_has_events) {
+			event->type = TB_EVENT_JOB;
+			return TB_OK;
+		}
+
 		memset(event, 0, sizeof(*event));
 		if_ok_return(rv, extract_event(event));
 	} while (timeout == -1);
@@ -29,18 +29,43 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fts.h>
+#include <time.h>
+#include <pthread.h>
+#include "arena.h"
 #include "client.h"
 #include "strlcpy.h"
 #include "file.h"
 #include "view.h"
 #include "trash.h"
 #include "util.h"
-#include "spawn.h"
+#include "sort.h"
+#include "meta.h"
+#include "index.h"
+#include "config.h"
 
 #define TRASH "/.trash"
-#define ID_LENGTH 32
+#define TRASH_MOUNT ".trash-" /* followed by the uid at a mount root */
+#define TRASH_MOUNTS "mounts" /* paths of the trashes of other mounts */
+#define TRASH_MAX 64
+#define TRASH_PURGE ".purge-" /* suffix of a trash being removed */
+#define TRASH_QUOTA 0 /* megabytes used by each trash, unlimited if zero */
+#define TRASH_AGE 0 /* days the files are kept, forever if zero */
+
+/* trash directory of a file system, the one of the home is the first */
+struct trash {
+	dev_t dev;
+	int fd;
+	off_t size; /* bytes used by the trashed files when last known */
+	char path[PATH_MAX];
+};
+
+/* The table is locked while the trashes are used outside of the job
+ * executor, where they are replaced by trash_clear. */
+static struct trash trashes[TRASH_MAX];
+static size_t trashes_length;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
-static int gethome(char *buf, size_t length) {
+int gethome(char *buf, size_t length) {
 
         struct passwd *pw;
 	char *home;
@@ -83,43 +108,174 @@ clean: /* make sure we're not deleting a whole folder by accident */
 	return -1;
 }
 
-int trash_init(void) {
-	char path[PATH_MAX];
-	int home, trash;
+/* Open the trash at path, creating it if needed. The trashes of the other
+ * mounts must belong to the user and be on the device dev. */
+static int trash_open(const char *path, dev_t dev, int home) {
+
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+	if (fd < 0 && errno == ENOENT && !mkdir(path, 0700))
+		fd = open(path, O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+	if (fd < 0) return -1;
+	if (fstat(fd, &st) || (!home && (st.st_dev != dev ||
+			st.st_uid != getuid() || st.st_mode & 077))) {
+		close(fd);
+		errno = EPERM;
+		return -1;
+	}
+	if (index_init(fd, path)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* known trash on the device dev, NULL if there's none */
+static struct trash *trash_find(dev_t dev) {
+	size_t i;
+	for (i = 0; i < trashes_length; i++)
+		if (trashes[i].fd > -1 && trashes[i].dev == dev)
+			return &trashes[i];
+	return NULL;
+}
 
-	if (gethome(V(path)) == -1) return -1;
+/* add the trash at path to the known ones, trashes is locked */
+static struct trash *trash_add(const char *path, int fd) {
+	struct trash *trash;
+	struct stat st;
+	if (trashes_length >= TRASH_MAX || fstat(fd, &st)) return NULL;
+	trash = &trashes[trashes_length];
+	trash->dev = st.st_dev;
+	trash->fd = fd;
+	trash->size = 0;
+	STRCPY(trash->path, path);
+	trashes_length++;
+	return trash;
+}
 
-	home = open(path, O_DIRECTORY);
-	if (home < 0) goto fail;
+/* Add the trashes of the other mounts listed in the trash of the home,
+ * the ones that can't be opened are on unmounted file systems. */
+static void trash_mounts(void) {
 
-	trash = openat(home, ".trash", O_DIRECTORY);
-	if (trash > -1)  {
-		close(home);
-		return trash;
+	char buf[PATH_MAX * 4], *line, *end;
+	ssize_t length;
+	int fd;
+
+	fd = openat(trashes[0].fd, TRASH_MOUNTS, O_RDONLY|O_CLOEXEC);
+	if (fd < 0) return;
+	length = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (length < 0) return;
+	buf[length] = '\0';
+
+	for (line = buf; (end = strchr(line, '\n')); line = end + 1) {
+		struct stat st;
+		*end = '\0';
+		if (stat(line, &st) || trash_find(st.st_dev)) continue;
+		fd = trash_open(line, st.st_dev, 0);
+		if (fd < 0) continue;
+		if (!trash_add(line, fd)) close(fd);
 	}
+}
 
-	if (mkdirat(home, ".trash", 0700)) goto fail;
+/* remember a new trash for the next sessions */
+static void trash_register(const char *path) {
+	char buf[PATH_MAX + 1];
+	int fd, length;
+	fd = openat(trashes[0].fd, TRASH_MOUNTS,
+			O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0600);
+	if (fd < 0) return;
+	length = snprintf(V(buf), "%s\n", path);
+	if (length < (int)sizeof(buf) && write(fd, buf, length) != length) {
+		/* only known for this session */
+	}
+	close(fd);
+}
 
-	trash = openat(home, ".trash", O_DIRECTORY);
-	if (trash < 0) goto fail;
+/* root of the mount of the directory at path on the device dev */
+static int trash_root(const char *path, dev_t dev, char *out, size_t length) {
+	if (strlcpy(out, path, length) >= length) return -1;
+	for (;;) {
+		struct stat st;
+		char *ptr = strrchr(out, '/');
+		if (!ptr) return -1;
+		if (ptr == out) {
+			if (stat("/", &st)) return -1;
+			if (st.st_dev == dev) ptr[1] = '\0';
+			return 0;
+		}
+		*ptr = '\0';
+		if (stat(out, &st)) return -1;
+		if (st.st_dev != dev) {
+			*ptr = '/';
+			return 0;
+		}
+	}
+}
 
-	close(home);
+/* Trash of the file system of the directory fd at path, a .trash-$UID
+ * directory at the root of its mount. The trash of the home is used if
+ * the mount can't have one, the files are then copied to it. */
+static struct trash *trash_get(int fd, const char *path) {
+
+	char root[PATH_MAX], dir[PATH_MAX];
+	struct trash *trash;
+	struct stat st;
+	int trashfd;
+
+	if (fstat(fd, &st)) return &trashes[0];
+	pthread_mutex_lock(&lock);
+	trash = trash_find(st.st_dev);
+	if (trash) goto end;
+	trash = &trashes[0];
+	if (trash_root(path, st.st_dev, V(root)) ||
+		snprintf(V(dir), "%s/" TRASH_MOUNT "%lu",
+			strcmp(root, "/") ? root : "",
+			(unsigned long)getuid()) >= (int)sizeof(dir))
+		goto end;
+	trashfd = trash_open(dir, st.st_dev, 0);
+	if (trashfd < 0) goto end;
+	trash = trash_add(dir, trashfd);
+	if (!trash) {
+		close(trashfd);
+		trash = &trashes[0];
+		goto end;
+	}
+	trash_register(dir);
+end:
+	pthread_mutex_unlock(&lock);
 	return trash;
-fail:
-	if (home > -1)
-		close(home);
-	return -1;
 }
 
-int trash_send(int fd, char *path, char *name) {
+int trash_init(void) {
+	char path[PATH_MAX];
+	int fd;
 
-	char buf[PATH_MAX * 2], id[ID_LENGTH + 1];
-	int info, len, error;
+	if (trash_path(V(path))) return -1;
+	fd = trash_open(path, 0, 1);
+	if (fd < 0) return -1;
 
-	info = openat(client.trash, "info", O_WRONLY|O_CREAT|O_APPEND, 0644);
-	if (info < 0)
-		return -1;
+	pthread_mutex_lock(&lock);
+	trashes_length = 0;
+	trash_add(path, fd);
+	trash_mounts();
+	pthread_mutex_unlock(&lock);
+	return fd;
+}
 
+/* Move the entry name of the directory fd at path to the trash of its file
+ * system. It runs on the job executor, like trash_clear which replaces the
+ * trashes, so the trash is not used while it is replaced. */
+int trash_send(int fd, char *path, char *name) {
+
+	char buf[PATH_MAX * 2], id[INDEX_ID + 1], trashed[PATH_MAX];
+	struct index_record record;
+	struct trash *trash;
+	int len, error;
+
+	trash = trash_get(fd, path);
 	do {
 		size_t i;
 		int try;
@@ -132,44 +288,242 @@ int trash_send(int fd, char *path, char *name) {
 		id[sizeof(id) - 1] = '\0';
 
 		/* check if there's not already a file with that id */
-		try = openat(client.trash, id, O_RDONLY);
+		try = openat(trash->fd, id, O_RDONLY);
 		if (try < 0) break;
 		close(try);
 	} while (1);
 
-	trash_path(V(buf));
-	error = file_move(path, fd, name, client.trash, buf, id);
-	if (!error) {
-		len = snprintf(V(buf), "%s %s/%s\n", id, path, name);
-		error = -(write(info, buf, len) != len);
+	error = file_move(path, fd, name, trash->fd, trash->path, id, NULL);
+	if (error) return error;
+	len = snprintf(V(buf), "%s/%s", path, name);
+	if (len >= (int)sizeof(buf)) return -1;
+
+	/* measured once in the trash, where it doesn't change anymore */
+	record.id = id;
+	record.path = buf;
+	record.length = len;
+	record.time = time(NULL);
+	record.size = 0;
+	if (snprintf(V(trashed), "%s/%s", trash->path, id) <
+			(int)sizeof(trashed))
+		record.size = index_usage(trashed);
+	if (record.size < 0) record.size = 0;
+	if (index_add(trash->fd, &record)) return -1;
+
+	pthread_mutex_lock(&lock);
+	trash->size += record.size;
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+/* Add the trashes set aside and not removed, by an interrupted clear or
+ * by another instance, to asides. */
+static void trash_leftovers(struct trash *trash, struct arena *asides) {
+
+	char parent[PATH_MAX], prefix[PATH_MAX];
+	struct dirent *entry;
+	char *base;
+	size_t length;
+	DIR *dir;
+
+	STRCPY(parent, trash->path);
+	base = strrchr(parent, '/');
+	if (!base) return;
+	*base++ = '\0';
+	length = snprintf(V(prefix), "%s" TRASH_PURGE, base);
+	if (length >= sizeof(prefix)) return;
+	dir = opendir(*parent ? parent : "/");
+	if (!dir) return;
+	while ((entry = readdir(dir))) {
+		char path[PATH_MAX];
+		struct stat st;
+		if (strncmp(entry->d_name, prefix, length)) continue;
+		if (snprintf(V(path), "%s/%s", parent, entry->d_name) >=
+				(int)sizeof(path) ||
+			lstat(path, &st) || !S_ISDIR(st.st_mode) ||
+			st.st_uid != getuid())
+			continue;
+		arena_add(asides, path, strlen(path));
 	}
-	close(info);
+	closedir(dir);
+}
+
+/* unique path of files set aside to be removed, prefix followed by
+ * TRASH_PURGE */
+static int trash_aside(const char *prefix, char *out, size_t length) {
+	static unsigned long asides;
+	if (snprintf(out, length, "%s" TRASH_PURGE "%ld-%lu-%lu", prefix,
+			(long)getpid(), (unsigned long)time(NULL),
+			asides++) < (int)length)
+		return 0;
+	errno = ENAMETOOLONG;
+	return -1;
+}
+
+/* Empty every trash: each one is renamed aside and created again, the
+ * paths of the old ones are added to asides to be removed. It runs on the
+ * job executor to not replace a trash used by a delete. */
+int trash_clear(struct arena *asides) {
+
+	size_t i;
+	int error = 0;
 
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < trashes_length; i++) {
+		struct trash *trash = &trashes[i];
+		char aside[PATH_MAX];
+		int fd;
+		if (trash->fd < 0) continue;
+		trash_leftovers(trash, asides);
+		if (trash_aside(trash->path, V(aside)) ||
+			rename(trash->path, aside)) {
+			error = -1;
+			continue;
+		}
+		fd = trash_open(trash->path, trash->dev, !i);
+		if (fd < 0) {
+			error = -1;
+			/* kept rather than sending files to a removed trash */
+			if (!rename(aside, trash->path)) continue;
+			close(trash->fd);
+			trash->fd = -1;
+			arena_add(asides, aside, strlen(aside));
+			continue;
+		}
+		arena_add(asides, aside, strlen(aside));
+		/* the trashes of the other mounts are still known */
+		if (!i && renameat(trash->fd, TRASH_MOUNTS, fd, TRASH_MOUNTS) &&
+				errno != ENOENT)
+			error = -1;
+		close(trash->fd);
+		trash->fd = fd;
+		trash->size = 0;
+	}
+	client.trash = trashes[0].fd;
+	pthread_mutex_unlock(&lock);
 	return error;
 }
 
-int trash_clear(void) {
+static int trash_older(const void *a, const void *b) {
+	time_t x = ((const struct index_record*)a)->time;
+	time_t y = ((const struct index_record*)b)->time;
+	return x < y ? -1 : x > y;
+}
 
-	char path[PATH_MAX];
+/* Move the oldest files of the trash to a directory in it while it uses
+ * more than quota bytes, or while they were trashed before the time
+ * before. They are removed from the index and the directory is added to
+ * asides, it is removed with the trash if the purge is interrupted. */
+static int trash_shrink(struct trash *trash, off_t quota, time_t before,
+			struct arena *asides) {
+
+	struct index index;
+	const char **ids;
+	char dir[PATH_MAX], aside[PATH_MAX];
+	size_t i, count, length;
+	off_t size;
+	int fd, ret;
+
+	if (index_load(trash->fd, &index)) return -1;
+	trash->size = index.size;
+	qsort(index.records, index.count, sizeof(struct index_record),
+		trash_older);
+	size = index.size;
+	for (count = 0; count < index.count; count++) {
+		struct index_record *record = &index.records[count];
+		if ((!quota || size <= quota) && record->time >= before)
+			break;
+		size -= record->size;
+	}
+	ret = 0;
+	if (!count) goto end;
+
+	ret = -1;
+	ids = malloc(count * sizeof(const char*));
+	if (!ids) goto end;
+	if (snprintf(V(dir), "%s/", trash->path) >= (int)sizeof(dir) ||
+		trash_aside(dir, V(aside)) || mkdir(aside, 0700)) {
+		free(ids);
+		goto end;
+	}
+	fd = open(aside, O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+	if (fd < 0) {
+		rmdir(aside);
+		free(ids);
+		goto end;
+	}
+	for (i = length = 0; i < count; i++) {
+		struct index_record *record = &index.records[i];
+		char id[INDEX_ID + 1];
+		memcpy(id, record->id, INDEX_ID);
+		id[INDEX_ID] = '\0';
+		/* restored by another instance if it is gone */
+		if (renameat(trash->fd, id, fd, id) && errno != ENOENT)
+			continue;
+		ids[length++] = record->id;
+		trash->size -= record->size;
+	}
+	close(fd);
+	ret = index_remove(trash->fd, ids, length);
+	free(ids);
+	if (arena_add(asides, aside, strlen(aside)) == ARENA_ERR) ret = -1;
+end:
+	index_free(&index);
+	return ret;
+}
 
-	if (trash_path(V(path))) return -1;
-	if (spawn("rm", 1, 1, "-r", path)) return -1;
+/* Set aside the oldest files of each trash while it uses more than
+ * MZ_TRASH_QUOTA megabytes and the ones trashed more than MZ_TRASH_AGE
+ * days ago, their paths are added to asides to be removed in the
+ * background. */
+int trash_expire(struct arena *asides) {
 
-	close(client.trash);
-	client.trash = trash_init();
-	if (client.trash < 0) return -1;
+	off_t quota;
+	time_t before;
+	long age;
+	size_t i;
+	int error = 0;
 
-	return 0;
+	quota = (off_t)config_number("MZ_TRASH_QUOTA", TRASH_QUOTA) *
+			1024 * 1024;
+	age = config_number("MZ_TRASH_AGE", TRASH_AGE);
+	if (!quota && !age) return 0;
+	before = age ? time(NULL) - (time_t)age * 24 * 60 * 60 : 0;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < trashes_length; i++) {
+		if (trashes[i].fd < 0) continue;
+		if (trash_shrink(&trashes[i], quota, before, asides))
+			error = -1;
+	}
+	pthread_mutex_unlock(&lock);
+	return error;
 }
 
-int trash_rawpath(struct view *view, char *out, size_t length) {
+/* bytes used by the files of every trash */
+off_t trash_size(void) {
+	off_t size = 0;
+	size_t i;
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < trashes_length; i++)
+		size += trashes[i].size;
+	pthread_mutex_unlock(&lock);
+	return size;
+}
 
-	char path[PATH_MAX];
+/* bytes used by the trashed file of an entry, kept after its path */
+static off_t trash_used(struct view *view, struct entry *entry) {
+	const char *path = &view->names.data[entry->other];
+	off_t size;
+	memcpy(&size, &path[strlen(path) + 1], sizeof(size));
+	return size > 0 ? size : 0;
+}
 
+/* the entries of the trash view keep the path of the trashed file */
+int trash_rawpath(struct view *view, char *out, size_t length) {
 	if (view->fd != TRASH_FD) return -1;
-	if (trash_path(V(path))) return -1;
-	if (snprintf(out, length, "%s/%s", path,
-			(char*)SELECTED(view).other) >= (int)length)
+	if (strlcpy(out, &view->names.data[SELECTED(view).other], length) >=
+			length)
 		return -1;
 	return 0;
 }
@@ -177,7 +531,6 @@ int trash_rawpath(struct view *view, char *out, size_t length) {
 int trash_restore(struct view *view) {
 
 	size_t i;
-	char path[PATH_MAX];
 	int error = 0;
 
 	if (view->fd != TRASH_FD) {
@@ -185,22 +538,23 @@ int trash_restore(struct view *view) {
 		return -1;
 	}
 
-	if (trash_path(V(path))) return -1;
-
 	i = 0;
 	while (i < view->length) {
 
-		char src[PATH_MAX];
-		char *id;
+		char src[PATH_MAX], dir[PATH_MAX];
+		char *id, *name;
 		size_t j = i++;
-		int fd;
+		int fd, trash;
 
 		if (!view->entries[j].selected) continue;
-		id = view->entries[j].other;
-		snprintf(V(src), "%s/%s", path, id);
+		STRCPY(dir, &view->names.data[view->entries[j].other]);
+		id = strrchr(dir, '/');
+		if (!id) continue;
+		*id++ = '\0';
+		name = NAME(view, view->entries[j]);
 
 		/* check if file exist before using rename */
-		fd = open(view->entries[j].name, 0);
+		fd = open(name, 0);
 		if (fd > -1) {
 			close(fd);
 			errno = EEXIST;
@@ -208,18 +562,23 @@ int trash_restore(struct view *view) {
 			continue;
 		}
 
-		if (rename(src, view->entries[j].name)) {
-			char *name;
+		if (rename(&view->names.data[view->entries[j].other], name)) {
 			int ret;
 			if (errno != EXDEV) return -1;
-			STRCPY(src, view->entries[j].name);
+			STRCPY(src, name);
 			name = strrchr(src, '/');
 			if (!name) return -1;
 			*name = '\0';
 			name++;
 			fd = open(src, O_DIRECTORY);
 			if (fd < 0) return -1;
-			ret = file_move(path, client.trash, id, fd, src, name);
+			trash = open(dir, O_DIRECTORY);
+			if (trash < 0) {
+				close(fd);
+				return -1;
+			}
+			ret = file_move(dir, trash, id, fd, src, name, NULL);
+			close(trash);
 			close(fd);
 			if (ret < 0) return -1;
 		}
@@ -229,145 +588,158 @@ int trash_restore(struct view *view) {
 	return error;
 }
 
+/* Forget the restored entries, they are removed from the index by a
+ * single write and from the listing, their sizes from the size of their
+ * trash. */
 int trash_refresh(struct view *view) {
 
-	void *next, *prev;
-	size_t i;
-	int fd, rewrite;
+	const char **ids;
+	size_t i, j, k, count;
+	int ret;
 
-	i = 0;
-	rewrite = 0;
-	while (i < view->length) {
-		switch (view->entries[i].selected) {
-		case -1:
-			rewrite = 1;
-			break;
-		case 1:
-			view->entries[i].selected = 0;
-			break;
+	count = 0;
+	for (i = 0; i < view->length; i++) {
+		if (view->entries[i].selected == -1) count++;
+		else view->entries[i].selected = 0;
+	}
+	if (!count) return 0;
+
+	ids = malloc(count * sizeof(const char*));
+	if (!ids) return -1;
+	ret = 0;
+	pthread_mutex_lock(&lock);
+	/* the ids of each trash are removed from its own index */
+	for (k = 0; k < trashes_length; k++) {
+		size_t len = strlen(trashes[k].path);
+		off_t restored = 0;
+		for (i = j = 0; i < view->length; i++) {
+			const char *path;
+			if (view->entries[i].selected != -1) continue;
+			path = &view->names.data[view->entries[i].other];
+			if (strncmp(path, trashes[k].path, len) ||
+					path[len] != '/')
+				continue;
+			ids[j++] = &path[len + 1];
+			restored += trash_used(view, &view->entries[i]);
 		}
-		i++;
+		if (!j) continue;
+		if (index_remove(trashes[k].fd, ids, j)) ret = -1;
+		trashes[k].size -= restored;
+		if (trashes[k].size < 0) trashes[k].size = 0;
 	}
-	if (!rewrite) return 0;
+	pthread_mutex_unlock(&lock);
+	free(ids);
 
-	/* rewrite info file */
-	fd = openat(client.trash, "info", O_CREAT|O_WRONLY|O_TRUNC, 0644);
-	if (fd < 0) return -1;
+	for (i = j = 0; i < view->length; i++) {
+		if (view->entries[i].selected == -1) continue;
+		view->entries[j++] = view->entries[i];
+	}
+	view->length = j;
+	if (file_filter(view, FILE_NOPOS)) return -1;
+	return ret;
+}
 
-	i = 0;
-	while (i < view->length) {
+/* stat the trashed files all at once to know which ones are directories */
+static void trash_types(struct view *view) {
 
-		char c;
-		size_t j = i++;
-		ssize_t length;
+	struct meta *metas;
+	size_t i;
 
-		if (view->entries[j].selected == -1) continue;
+	metas = malloc(AZ(view->length) * sizeof(struct meta));
+	if (!metas) return;
+	for (i = 0; i < view->length; i++)
+		metas[i].name = &view->names.data[view->entries[i].other];
+	meta_stat(AT_FDCWD, metas, view->length, 0);
+	for (i = 0; i < view->length; i++) {
+		if (!metas[i].error && S_ISDIR(metas[i].st.st_mode))
+			view->entries[i].type = DT_DIR;
+	}
+	free(metas);
+}
 
-		if (write(fd, view->entries[j].other, ID_LENGTH) != ID_LENGTH)
-			break;
-		c = ' ';
-		if (write(fd, &c, 1) != 1) break;
-		length = strnlen(V(view->entries[j].name));
-		if (write(fd, view->entries[j].name, length) != length) break;
-		c = '\n';
-		if (write(fd, &c, 1) != 1) break;
+/* add the entries of a trash from its index, trashes is locked */
+static int trash_entries(struct view *view, struct trash *trash) {
+
+	struct index index;
+	size_t i, length;
+	void *ptr;
+	int ret;
+
+	if (index_load(trash->fd, &index)) return -1;
+	trash->size = index.size;
+	ptr = realloc(view->entries,
+			AZ(view->length + index.count) * sizeof(struct entry));
+	if (!ptr) goto fail;
+	view->entries = ptr;
+	view->allocated = AZ(view->length + index.count);
+	/* the paths, their sort keys and the paths of the trashed files
+	 * followed by their sizes */
+	length = strlen(trash->path);
+	if (!arena_reserve(&view->names, index.length * 2 +
+				index.count * (length + 1 + sizeof(off_t))))
+		goto fail;
+
+	for (i = 0; i < index.count; i++) {
+		struct index_record *record = &index.records[i];
+		struct entry *entry = &view->entries[view->length];
+		char *path;
+		RZERO(*entry);
+		entry->length = record->length;
+		entry->name = arena_add(&view->names, record->path,
+					record->length);
+		if (entry->name == ARENA_ERR) goto fail;
+		ret = sort_key(&view->names, record->path, record->length);
+		if (ret < 0) goto fail;
+		entry->key_length = ret;
+		path = arena_reserve(&view->names,
+				length + 1 + INDEX_ID + 1 + sizeof(off_t));
+		if (!path) goto fail;
+		memcpy(path, trash->path, length);
+		path[length] = '/';
+		memcpy(&path[length + 1], record->id, INDEX_ID);
+		path[length + 1 + INDEX_ID] = '\0';
+		memcpy(&path[length + 1 + INDEX_ID + 1], &record->size,
+			sizeof(off_t));
+		entry->other = view->names.length;
+		view->names.length += length + 1 + INDEX_ID + 1 + sizeof(off_t);
+		entry->type = DT_REG;
+		view->length++;
 	}
-	close(fd);
+	index_free(&index);
+	return 0;
+fail:
+	index_free(&index);
+	return -1;
+}
 
-	i = 0;
+/* List the entries of the trashes of every file system again, the tab
+ * keeps its place, its cursor and its filters. */
+int trash_reload(struct view *view) {
 
-	next = view->next;
-	prev = view->prev;
-	trash_view(view);
-	view->next = next;
-	view->prev = prev;
+	size_t i;
 
-	if (i != view->length) return -1;
+	file_free(view);
+	pthread_mutex_lock(&lock);
+	trash_mounts();
+	/* the other trashes may be on a failing or unmounted file system */
+	for (i = 0; i < trashes_length; i++) {
+		if (trash_entries(view, &trashes[i]) && !i) {
+			pthread_mutex_unlock(&lock);
+			file_free(view);
+			return -1;
+		}
+	}
+	pthread_mutex_unlock(&lock);
 
-	return 0;
+	trash_types(view);
+	sort_entries(view->entries, view->length, &view->names);
+	return file_filter(view, FILE_NOPOS);
 }
 
+/* the entries of the trashes of every file system in a new view */
 int trash_view(struct view* view) {
-
-	int fd;
-	size_t i;
-	char buf[PATH_MAX * 2];
-
 	PZERO(view);
 	STRCPY(view->path, "Trash");
 	view->fd = TRASH_FD;
-
-	fd = openat(client.trash, "info", O_RDONLY);
-	if (fd < 0) return 0;
-
-	i = 0;
-	for (;;) {
-
-		void *ptr;
-		char id[ID_LENGTH];
-		char c;
-		size_t j;
-
-		j = read(fd, V(id));
-		if (!j) { /* success : end of file */
-			close(fd);
-			qsort(view->entries, view->length,
-				sizeof(struct entry), file_sort);
-			return 0;
-		}
-		if (j != sizeof(id)) break;
-
-		j = 0;
-		while (j < sizeof(id)) {
-			if (id[j] > 'z' || id[j] < 'a') break;
-			j++;
-		}
-		if (j != sizeof(id)) break;
-
-		if (read(fd, &c, 1) != 1 || c != ' ') break;
-
-		j = 0;
-		while (j < sizeof(buf)) {
-			if (read(fd, &c, 1) != 1) break;
-			if (c == '\n') {
-				buf[j] = 0;
-				break;
-			}
-			buf[j] = c;
-			j++;
-		}
-
-		ptr = realloc(view->entries, sizeof(struct entry) * (i + 1));
-		if (!ptr) break;
-		view->entries = ptr;
-		RZERO(view->entries[i]);
-
-		STRCPY(view->entries[i].name, buf);
-		view->entries[i].type = DT_REG;
-		{
-			struct stat s;
-			char path[ID_LENGTH + 1];
-			memcpy(path, id, ID_LENGTH);
-			path[ID_LENGTH] = 0;
-			view->entries[i].type =
-				fstatat(client.trash, path, &s, 0) ?
-					DT_REG : (S_ISDIR(s.st_mode) ?
-						DT_DIR : DT_REG);
-		}
-		view->length = i + 1;
-
-		view->entries[i].other = calloc(ID_LENGTH + 1, 1);
-		if (!view->entries[i].other) break;
-		memcpy(view->entries[i].other, V(id));
-
-		i++;
-	}
-
-	for (i = 0; i < view->length; i++)
-		free(view->entries[i].other);
-	free(view->entries);
-	view->length = 0;
-	view->entries = NULL;
-	close(fd);
-	return 0;
+	return trash_reload(view);
 }
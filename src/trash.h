@@ -16,11 +16,15 @@
 
 #define TRASH_FD (-11)
 
+int gethome(char *buf, size_t length);
 int trash_init(void);
 int trash_send(int fd, char *path, char *name);
 int trash_view(struct view* view);
+int trash_reload(struct view *view);
 int trash_restore(struct view *view);
 int trash_refresh(struct view *view);
 int trash_path(char *out, size_t length);
 int trash_rawpath(struct view *view, char *out, size_t length);
-int trash_clear(void);
+int trash_clear(struct arena *asides);
+int trash_expire(struct arena *asides);
+off_t trash_size(void);
@@ -15,8 +15,10 @@
  */
 #define V(X) X, sizeof(X) /* the value and its size */
 #define VP(X) X, sizeof(*X) /* the pointer and its value size */
-#define SELECTED(X) X->entries[X->selected]
-#define EMPTY(X) (X->selected >= X->length)
+#define ENTRY(X, I) X->entries[X->index[I]] /* I-th entry passing the filters */
+#define SELECTED(X) ENTRY(X, X->selected)
+#define NAME(X, E) (&(X)->names.data[(E).name]) /* name of an entry */
+#define EMPTY(X) (X->selected >= X->count)
 
 /* Assign the sum of X and Y to X if the sum is lesser than Z, else assign Z */
 #define ADDMAX(X, Y, Z) X = ((X + Y) > Z ? Z : (X + Y))
@@ -31,6 +33,7 @@
 #define STRCPY(X, Y) strlcpy(X, Y, sizeof(X))
 #define STARTWITH(X, Y) (!strncmp(X, V(Y) - 1))
 
+#define LENGTH(X) (sizeof(X) / sizeof(*X)) /* number of elements in an array */
 #define TOGGLE(X) (X = !X)
 #define MAX(X, Y) (X > Y ? Y : X) /* if X is greater than Y return Y */
 
@@ -42,6 +45,14 @@
 #define DT_DIR 1
 #endif
 
+#ifndef DT_UNKNOWN
+#define DT_UNKNOWN (-1)
+#endif
+
+#ifndef DT_LNK
+#define DT_LNK (-2)
+#endif
+
 #ifndef PATH_MAX
 #define PATH_MAX 1024
 #endif
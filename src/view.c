@@ -26,7 +26,9 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <sys/types.h>
 #include "termbox.h"
+#include "arena.h"
 #include "client.h"
 #include "view.h"
 #include "file.h"
@@ -67,11 +69,16 @@ void view_open(struct view *view) {
 
 	char name[PATH_MAX];
 
-	if (view->length < 1)
+	if (EMPTY(view))
 		return;
 
 	client.error = 0;
-	switch (view->entries[view->selected].type) {
+	if (file_resolve(view, view->selected, 1)) {
+		STRCPY(client.info, strerror(errno));
+		client.error = 1;
+		return;
+	}
+	switch (SELECTED(view).type) {
 	case DT_REG:
 		if (view->fd == TRASH_FD) {
 			trash_rawpath(view, V(name));
@@ -81,7 +88,7 @@ void view_open(struct view *view) {
 				client.error = 1;
 				break;
 			}
-			if (format_path(SELECTED(view).name, V(name))) {
+			if (format_path(NAME(view, SELECTED(view)), V(name))) {
 				STRCPY(client.info, "path too long");
 				client.error = 1;
 				break;
@@ -94,7 +101,7 @@ void view_open(struct view *view) {
 		break;
 	case DT_DIR:
 		if (view->fd == TRASH_FD) break;
-		if (file_cd(view, SELECTED(view).name)) {
+		if (file_cd(view, NAME(view, SELECTED(view)))) {
 			STRCPY(client.info, strerror(errno));
 			client.error = 1;
 			break;
@@ -113,7 +120,7 @@ void view_draw(struct view *view) {
 	if (view->selected < view->scroll)
 		view->scroll = view->selected;
 
-	while (i + view->scroll < view->length) {
+	while (i + view->scroll < view->count) {
 		int selected;
 		struct entry *e;
 		uintattr_t fg, bg;
@@ -124,7 +131,7 @@ void view_draw(struct view *view) {
 		fg = bg = TB_DEFAULT;
 
 		selected = view->selected == i + view->scroll;
-		e = &view->entries[i + view->scroll];
+		e = &ENTRY(view, i + view->scroll);
 		if (selected) {
 			fg = TB_WHITE;
 			bg = TB_CYAN;
@@ -137,9 +144,13 @@ void view_draw(struct view *view) {
 			fg = TB_WHITE;
 		if (e->selected && selected)
 			fg = e->type == DT_REG ? TB_BLACK : TB_GREEN;
-		tb_print(0, i + start, fg, bg, e->name);
+		/* placeholder until the type of the entry is known */
+		if (e->flags & ENTRY_UNRESOLVED && !selected && !e->selected)
+			fg = TB_YELLOW;
+		tb_print(0, i + start, fg, bg, NAME(view, *e));
 		if (e->type == DT_DIR) {
-			tb_set_cell(utf8_width(e->name, PATH_MAX), i + start,
+			tb_set_cell(utf8_width(NAME(view, *e), e->length),
+					i + start,
 					'/', fg, bg);
 		}
 		i++;
@@ -148,9 +159,9 @@ void view_draw(struct view *view) {
 
 void view_select(struct view *view, const char *name) {
 	file_select(view, name);
-	if (view->length < HEIGHT) return;
-	if (view->selected >= view->length - HEIGHT / 2) {
-		view->scroll = view->length - HEIGHT - 1;
+	if (view->count < HEIGHT) return;
+	if (view->selected >= view->count - HEIGHT / 2) {
+		view->scroll = view->count - HEIGHT - 1;
 	} else if (view->selected > HEIGHT / 2) {
 		view->scroll = view->selected - HEIGHT / 2;
 	}
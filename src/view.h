@@ -14,14 +14,37 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+/* status of a directory when it was listed */
+struct stamp {
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	time_t ctime;
+	time_t listed;
+};
+
 struct view {
 	unsigned int scroll;
 	unsigned int selected;
 	int fd;
 	char path[1024];
-	struct entry *entries;
+	struct entry *entries; /* every entry of the directory, sorted */
 	size_t length;
+	size_t allocated;
+	size_t *index; /* positions of the entries passing the filters */
+	size_t count; /* number of entries passing the filters */
+	struct arena names;
+	struct dir *loading; /* directory being read, NULL once listed */
+	char *pending; /* name of the entry to select once it is read */
+	int outdated; /* the directory changed while it was being read */
+	double started;
+	size_t unresolved; /* entries whose type is not known yet */
+	size_t resolving; /* position where the resolution continues */
+	struct stamp stamp;
 	int showhidden;
+	int showtype; /* only show entries of this type if not zero */
+	char filter[256]; /* only show entries matching this pattern */
+	double elapsed; /* time spent listing the directory in seconds */
 	int size;
 	struct view *next;
 	struct view *prev;